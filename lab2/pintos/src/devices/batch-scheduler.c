@@ -1,40 +1,61 @@
-/* Tests cetegorical mutual exclusion with different numbers of threads.
- * Automatic checks only catch severe problems like crashes.
+/* Bus arbiter for the batch scheduler: tasks sending data to and
+ * receiving data from an accelerator share a bus made of one or
+ * more independent lanes.  Each lane carries at most its capacity
+ * of tasks, all going in the lane's current direction.
  */
+#include "devices/batch-scheduler.h"
 #include <stdio.h>
-#include "tests/threads/tests.h"
+#include <string.h>
 #include "threads/malloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "devices/timer.h"
 #include "lib/random.h" //generate random numbers
 
+/* Default number of tasks that may use a lane at the same time. */
+#ifndef BUS_CAPACITY
 #define BUS_CAPACITY 3
-#define SENDER 0
-#define RECEIVER 1
-#define NORMAL 0
-#define HIGH 1
-
-/*
- *	initialize task with direction and priority
- *	call o
- * */
-typedef struct {
-	int direction;
-	int priority;
-} task_t;
-
-
-struct semaphore busslot;              /* Used to ensure, that no more than 3 threads are using the bus */
-struct semaphore sendPrioLow;          /* Used to indicate, if high priority sender tasks are remaining */
-struct semaphore receivePrioLow;       /* Used to indicate, if high priority receiver tasks are remaining */
-struct semaphore varHighPrio_send;     /* Used to prevent race-conditions for variable 'highPrio_receive */
-struct semaphore varHighPrio_receive;  /* Used to prevent race-conditions for variable 'highPrio_send' */
-struct semaphore varBusdir;            /* Used to prevent race-conditions for variable 'busdir' */
-struct semaphore direction;            /* Used to make threads wait, until the direction is right for the thread */
-
-void batchScheduler(unsigned int num_tasks_send, unsigned int num_task_receive,
-        unsigned int num_priority_send, unsigned int num_priority_receive);
+#endif
+
+/* Default number of lanes. */
+#ifndef BUS_LANES
+#define BUS_LANES 1
+#endif
+
+/* Number of tasks admitted to a lane in one direction before the
+   lane turns around for tasks of the same class waiting on the
+   other side.  Larger batches mean fewer direction switches but
+   longer waits for the opposite direction. */
+#ifndef BUS_BATCH_LIMIT
+#define BUS_BATCH_LIMIT (2 * BUS_CAPACITY)
+#endif
+
+/* Number of ticks a normal task waits before it ages into a high
+   priority one.  An aged task goes before high priority tasks of
+   its direction that have not aged, so after aging it waits only
+   for the tasks already on the bus, at most one batch of
+   BUS_BATCH_LIMIT high priority tasks per lane going the other
+   way, and other aged tasks of its direction.  A steady stream of
+   high priority tasks thus holds it back for little more than
+   BUS_AGING_TICKS.  0 disables aging. */
+#ifndef BUS_AGING_TICKS
+#define BUS_AGING_TICKS 100
+#endif
+
+/* One lane of the bus. */
+struct lane
+  {
+    unsigned int capacity;      /* Maximum tasks on the lane */
+    unsigned int on_bus;        /* Number of tasks on the lane */
+    unsigned int batch;         /* Tasks admitted since the last switch */
+    int busdir;                 /* Direction of the lane */
+  };
+
+/* The bus is a monitor: BUS_LOCK protects every variable below,
+   and tasks that may not enter yet wait on the condition of their
+   direction and priority. */
+struct lock bus_lock;
+struct condition bus_free[2][2];       /* Indexed by direction, priority. */
 
 void senderTask(void *);
 void receiverTask(void *);
@@ -43,42 +64,74 @@ void receiverPriorityTask(void *);
 
 
 void oneTask(task_t task);/*Task requires to use the bus and executes methods below*/
-	void getSlot(task_t task); /* task tries to use slot on the bus */
-	void transferData(task_t task); /* task processes data on the bus either sending or receiving based on the direction*/
-	void leaveSlot(task_t task); /* task release the slot */
-
-void setDirection(int);
-
-
-static unsigned int numHighPrio_send;      /* Number of remaining high priority sender tasks */
-static unsigned int numHighPrio_receive;   /* Number of remaining high priority receiver tasks */
-static int busdir;                      /* Direction of the bus */
-
-/* initializes semaphores */ 
-void init_bus(void){ 
- 
-    random_init((unsigned int)123456789); 
-
-    sema_init(&busslot,BUS_CAPACITY);
-
-    sema_init(&varHighPrio_send,1);
-    sema_init(&varHighPrio_receive,1);
-
-    /* The semaphores get downed, because we assume that there will be high priority tasks.
-       If there are none, we up the semaphores before we create all threads in the function 
-       'batch-scheduler' */
-    sema_init(&sendPrioLow,1);
-    sema_down(&sendPrioLow);
-    sema_init(&receivePrioLow,1);
-    sema_down(&receivePrioLow);
+	void getSlot(task_t *task); /* task tries to use slot on the bus */
+	void transferData(task_t *task); /* task processes data on the bus either sending or receiving based on the direction*/
+	void leaveSlot(task_t *task); /* task release the slot */
+
+static unsigned spawn_tasks (const char *name, int thread_priority,
+                             thread_func *, int task_priority,
+                             unsigned int cnt);
+static int pick_lane (const task_t *task, int prio);
+static bool lane_may_enter (const struct lane *, int dir, int prio);
+static void wake_waiters (void);
+
+static struct lane lanes[BUS_MAX_LANES]; /* Lanes of the bus */
+static unsigned int lane_cnt;       /* Number of lanes in use */
+static unsigned int waiting[2][2];  /* Waiting tasks, by direction, priority */
+static unsigned int high_pending;   /* High priority tasks not yet on the bus */
+static unsigned int aged_waiting[2]; /* Aged tasks waiting, by direction */
+static unsigned int active;         /* Tasks created but not yet done */
+static unsigned int admissions;     /* Tasks admitted since init_bus() */
+static struct bus_stats stats;      /* Arbiter statistics */
+static bus_trace_func *trace;       /* Called for each finished task */
+
+/* initializes the bus monitor and its statistics */
+void init_bus(void){
+    int dir, prio;
+
+    random_init((unsigned int)123456789);
+
+    lock_init (&bus_lock);
+    for (dir = SENDER; dir <= RECEIVER; dir++)
+      for (prio = NORMAL; prio <= HIGH; prio++)
+        {
+          cond_init (&bus_free[dir][prio]);
+          waiting[dir][prio] = 0;
+        }
+    aged_waiting[SENDER] = aged_waiting[RECEIVER] = 0;
+
+    high_pending = 0;
+    active = 0;
+    admissions = 0;
+    memset (&stats, 0, sizeof stats);
+    stats.first_arrival = -1;
+    trace = NULL;
+    bus_set_lanes (BUS_LANES, NULL);
+}
 
-    sema_init(&varBusdir,1);
-    sema_init(&direction,1);
+/* Splits the bus into CNT lanes, where lane I carries up to
+   CAPACITY[I] tasks at a time, or BUS_CAPACITY if CAPACITY is a
+   null pointer.  CNT must be between 1 and BUS_MAX_LANES.  Call
+   only while no tasks are active, e.g. right after init_bus(). */
+void
+bus_set_lanes (unsigned int cnt, const unsigned int *capacity)
+{
+    unsigned int i;
 
-    /* Initialize static variables */
-    numHighPrio_send = 0;
-    numHighPrio_receive = 0;
-    busdir = -1;
+    ASSERT (cnt >= 1 && cnt <= BUS_MAX_LANES);
+
+    lock_acquire (&bus_lock);
+    ASSERT (active == 0);
+    lane_cnt = cnt;
+    for (i = 0; i < cnt; i++)
+      {
+        lanes[i].capacity = capacity != NULL ? capacity[i] : BUS_CAPACITY;
+        lanes[i].on_bus = 0;
+        lanes[i].batch = 0;
+        lanes[i].busdir = -1;
+        ASSERT (lanes[i].capacity > 0);
+      }
+    lock_release (&bus_lock);
 }
 
 /*
@@ -86,7 +139,7 @@ void init_bus(void){
     *  sending data to the accelerator and num_task_receive + num_priority_receive tasks
  *  reading data/results from the accelerator.
  *
- *  Every task is represented by its own thread. 
+ *  Every task is represented by its own thread.
  *  Task requires and gets slot on bus system (1)
  *  process data and the bus (2)
  *  Leave the bus (3).
@@ -95,161 +148,336 @@ void init_bus(void){
 void batchScheduler(unsigned int num_tasks_send, unsigned int num_tasks_receive,
         unsigned int num_priority_send, unsigned int num_priority_receive)
 {
-
-    numHighPrio_send = num_priority_send;
-    numHighPrio_receive = num_priority_receive;
-
-    /* If no high priority sender tasks are to be created/remaining, use semaphore 
-	 'sendPrioLow' to indicate that */
-    if (numHighPrio_send == 0)
-      sema_up(&sendPrioLow);
-    /* If no high priority receiver tasks are to be created/remaining, use semaphore 
-	 'receivePrioLow' to indicate that */
-    if (numHighPrio_receive == 0)
-      sema_up(&receivePrioLow);
-
-    unsigned int i;
     /* Create threads for high priority sender-tasks */
-    for (i = 0; i < num_priority_send; i++)
-      thread_create("sendPrioHigh", PRI_MAX, &senderPriorityTask, NULL);
+    spawn_tasks("sendPrioHigh", PRI_MAX, &senderPriorityTask, HIGH,
+                num_priority_send);
 
     /* Create threads for high priority receiver-tasks */
-    for (i = 0; i < num_priority_receive; i++)
-      thread_create("receivePrioHigh", PRI_MAX, &receiverPriorityTask, NULL);
+    spawn_tasks("receivePrioHigh", PRI_MAX, &receiverPriorityTask, HIGH,
+                num_priority_receive);
 
     /* Create threads for low priority sender-tasks */
-    for (i = 0; i < num_tasks_send; i++)
-      thread_create("sendPrioLow", PRI_MIN, &senderTask, NULL);
+    spawn_tasks("sendPrioLow", PRI_MIN, &senderTask, NORMAL,
+                num_tasks_send);
 
     /* Create threads for low priority receiver tasks */
-    for (i = 0; i < num_tasks_receive; i++)
-      thread_create("receicePrioLow", PRI_MIN, &receiverTask, NULL);    
+    spawn_tasks("receicePrioLow", PRI_MIN, &receiverTask, NORMAL,
+                num_tasks_receive);
+}
+
+/* Creates CNT threads named NAME running FUNC, each of which runs
+   one task of TASK_PRIORITY.  The tasks are registered with the
+   arbiter before any of the threads runs, so that normal tasks
+   created later cannot overtake high priority ones.  Returns the
+   number of threads actually created. */
+static unsigned
+spawn_tasks (const char *name, int thread_priority, thread_func *func,
+             int task_priority, unsigned int cnt)
+{
+    unsigned int i;
+
+    lock_acquire (&bus_lock);
+    active += cnt;
+    if (task_priority == HIGH)
+      high_pending += cnt;
+    lock_release (&bus_lock);
+
+    for (i = 0; i < cnt; i++)
+      if (thread_create(name, thread_priority, func, NULL) == TID_ERROR)
+        break;
+
+    /* Forget the tasks we could not create. */
+    if (i < cnt)
+      {
+        lock_acquire (&bus_lock);
+        active -= cnt - i;
+        if (task_priority == HIGH)
+          high_pending -= cnt - i;
+        wake_waiters ();
+        lock_release (&bus_lock);
+      }
+    return i;
 }
 
 /* Normal task,  sending data to the accelerator */
 void senderTask(void *aux UNUSED){
-        task_t task = {SENDER, NORMAL};
+        task_t task = {SENDER, NORMAL, 0, 0, 0, 0, false, 0};
         oneTask(task);
 }
 
 /* High priority task, sending data to the accelerator */
 void senderPriorityTask(void *aux UNUSED){
-        task_t task = {SENDER, HIGH};
+        task_t task = {SENDER, HIGH, 0, 0, 0, 0, false, 0};
         oneTask(task);
 }
 
 /* Normal task, reading data from the accelerator */
 void receiverTask(void *aux UNUSED){
-        task_t task = {RECEIVER, NORMAL};
+        task_t task = {RECEIVER, NORMAL, 0, 0, 0, 0, false, 0};
         oneTask(task);
 }
 
 /* High priority task, reading data from the accelerator */
 void receiverPriorityTask(void *aux UNUSED){
-        task_t task = {RECEIVER, HIGH};
+        task_t task = {RECEIVER, HIGH, 0, 0, 0, 0, false, 0};
         oneTask(task);
 }
 
 /* abstract task execution*/
 void oneTask(task_t task) {
-  getSlot(task);
-  transferData(task);
-  leaveSlot(task);
+  task.arrival = timer_cycles ();
+  getSlot(&task);
+  transferData(&task);
+  leaveSlot(&task);
 }
 
 
 /* task tries to get slot on the bus subsystem */
-void getSlot(task_t task) 
+void getSlot(task_t *task)
 {
-
-    /* Make the thread wait, until the direction is ok or until the bus is empty */
-    if (busdir != task.direction && busslot.value < BUS_CAPACITY) {
-      sema_down(&direction);
-    }
-
-    if (task.direction == SENDER) {
-      if (task.priority == HIGH) {
-	/* Acquire the slot on the bus */
-	sema_down(&busslot);
-      } else {
-        /* Acquire the slot on the bus, after all high priority sender tasks
-	   have gotten their slot */
-	sema_down(&sendPrioLow);
-	sema_down(&busslot);
-	sema_up(&sendPrioLow);
-      }
-      /* Set the bus-direction to SENDER if it isn't */
-      if (busdir != task.direction) {
-	setDirection(SENDER);
-      }
-    } else { 
-      if (task.priority == HIGH) {
-        /* Acquire the slot on the bus */
-	sema_down(&busslot);
-      } else {
-	/* Acquire the slot on the bus, after all high priority receiver tasks
-	   have gotten their slot */
-	sema_down(&receivePrioLow);
-	sema_down(&busslot);
-	sema_up(&receivePrioLow);
-      }
-      /* Set the bus-direction to RECEIVER if it isn't */
-      if (busdir != task.direction) {
-	setDirection(RECEIVER);
-      }
-
-    }
-    
-    
-    if (task.priority == HIGH && task.direction == SENDER) {
-      /* Update the number of remaining high priority sender tasks */
-      sema_down(&varHighPrio_send);
-      numHighPrio_send--;
-      sema_up(&varHighPrio_send);
-
-      /* If no high priority sender tasks are remaining, use semaphore 
-	 'sendPrioLow' to indicate that */
-      if (numHighPrio_send == 0)
-	sema_up(&sendPrioLow);
+  struct lane *l;
+  int64_t start = timer_ticks ();
+  int64_t wait;
+  int prio;
+  int lane;
+
+  lock_acquire (&bus_lock);
+  if (stats.first_arrival < 0)
+    stats.first_arrival = task->arrival;
+
+  /* PRIO is the task's effective priority, which rises to HIGH
+     once a normal task has waited BUS_AGING_TICKS. */
+  prio = task->priority;
+  waiting[task->direction][prio]++;
+  while ((lane = pick_lane (task, prio)) < 0)
+    {
+      cond_wait (&bus_free[task->direction][prio], &bus_lock);
+      if (prio == NORMAL && BUS_AGING_TICKS > 0
+          && timer_elapsed (start) >= BUS_AGING_TICKS)
+        {
+          waiting[task->direction][NORMAL]--;
+          prio = HIGH;
+          waiting[task->direction][HIGH]++;
+          aged_waiting[task->direction]++;
+          task->aged = true;
+          stats.aged++;
+        }
     }
-    
-    if (task.priority == HIGH && task.direction == RECEIVER) {
-      /* Update the number of remaining high priority receiver tasks */
-      sema_down(&varHighPrio_receive);
-      numHighPrio_receive--;
-      sema_up(&varHighPrio_receive);
-
-      /* If no high priority receiver tasks are remaining, use semaphore 
-	 'receivePrioLow' to indicate that */
-      if (numHighPrio_receive == 0)
-	sema_up(&receivePrioLow);
+  waiting[task->direction][prio]--;
+  if (task->aged)
+    aged_waiting[task->direction]--;
+
+  /* Turn the lane around if it was going the other way. */
+  l = &lanes[lane];
+  if (l->busdir != task->direction)
+    {
+      if (l->busdir != -1)
+        stats.switches++;
+      l->busdir = task->direction;
+      l->batch = 0;
     }
-    
+  l->on_bus++;
+  l->batch++;
+  task->lane = lane;
+  if (task->priority == HIGH)
+    high_pending--;
+
+  task->admitted = timer_cycles ();
+  task->order = admissions++;
+  wait = task->admitted - task->arrival;
+  stats.tasks[task->priority]++;
+  stats.wait_total[task->priority] += wait;
+  if (wait > stats.wait_max[task->priority])
+    stats.wait_max[task->priority] = wait;
+
+  /* The last high priority task may have been holding back
+     normal tasks, and the last aged task high priority ones. */
+  if ((task->priority == HIGH && high_pending == 0)
+      || (task->aged && aged_waiting[task->direction] == 0))
+    wake_waiters ();
+  lock_release (&bus_lock);
 }
 
 /* task processes data on the bus send/receive */
-void transferData(task_t task) 
+void transferData(task_t *task UNUSED)
 {
   /* Printing a message makes the tests fail.
      So we simply put a thread to sleep for a random number of ticks */
   timer_sleep(random_ulong() % 10);
 }
 
-/* task releases the slot */
-void leaveSlot(task_t task) 
+/* task releases the slot.  The trace function runs before the
+   task stops counting as active, so that once bus_active()
+   returns 0 no task is still inside it. */
+void leaveSlot(task_t *task)
+{
+  lock_acquire (&bus_lock);
+  lanes[task->lane].on_bus--;
+  task->departed = timer_cycles ();
+  stats.last_departure = task->departed;
+  if (trace != NULL)
+    trace (task);
+  active--;
+  wake_waiters ();
+  lock_release (&bus_lock);
+}
+
+/* Returns the lane TASK, whose effective priority is PRIO, should
+   take a slot on, or -1 if it has to wait.  Must be called with
+   BUS_LOCK held.
+
+   High priority tasks, including normal tasks that have aged,
+   always go before normal ones, in either direction.  Normal
+   tasks that have aged also go before high priority tasks of
+   their direction that have not, so that new high priority
+   arrivals cannot hold them back indefinitely.  Among the
+   lanes that would admit the task, picks the one where it is
+   expected to wait least: a lane already going its way before
+   one that has to turn around, and then the least loaded lane
+   relative to its capacity. */
+static int
+pick_lane (const task_t *task, int prio)
+{
+  const struct lane *best = NULL;
+  unsigned int i;
+
+  if (prio == NORMAL && high_pending > 0)
+    return -1;
+  if (prio == HIGH && !task->aged && aged_waiting[task->direction] > 0)
+    return -1;
+
+  for (i = 0; i < lane_cnt; i++)
+    {
+      const struct lane *l = &lanes[i];
+      bool same_dir, best_same_dir;
+
+      if (!lane_may_enter (l, task->direction, prio))
+        continue;
+      if (best == NULL)
+        {
+          best = l;
+          continue;
+        }
+
+      same_dir = l->busdir == task->direction;
+      best_same_dir = best->busdir == task->direction;
+      if (same_dir != best_same_dir)
+        {
+          if (same_dir)
+            best = l;
+        }
+      else if (l->on_bus * best->capacity < best->on_bus * l->capacity)
+        best = l;
+    }
+  return best != NULL ? best - lanes : -1;
+}
+
+/* Returns true if lane L may admit a task going in direction DIR
+   with effective priority PRIO.  Must be called with BUS_LOCK
+   held.
+
+   Within a class, a lane keeps its direction while tasks going
+   that way are queued, and only turns around once BUS_BATCH_LIMIT
+   tasks have been admitted and the other side has tasks of the
+   same class waiting.  A turn around waits for the lane to drain,
+   and need not wait for the batch if another lane already serves
+   the lane's old direction. */
+static bool
+lane_may_enter (const struct lane *l, int dir, int prio)
+{
+  int other = 1 - dir;
+  unsigned int i;
+
+  if (l->on_bus >= l->capacity)
+    return false;
+
+  if (l->busdir == dir)
+    {
+      /* Keep the batch going unless it has run its course and the
+         other side is waiting. */
+      return l->batch < BUS_BATCH_LIMIT || waiting[other][prio] == 0;
+    }
+
+  /* Only turn around on an empty lane, and only if the lane's
+     batch is done or has nobody left to admit. */
+  if (l->on_bus > 0)
+    return false;
+  if (l->busdir == -1
+      || l->batch >= BUS_BATCH_LIMIT
+      || waiting[l->busdir][prio] == 0)
+    return true;
+  for (i = 0; i < lane_cnt; i++)
+    if (&lanes[i] != l && lanes[i].busdir == l->busdir
+        && lanes[i].on_bus > 0)
+      return true;
+  return false;
+}
+
+/* Wakes every waiting task so it can recheck whether it may
+   enter, high priority tasks first.  Must be called with
+   BUS_LOCK held. */
+static void
+wake_waiters (void)
+{
+  int dir, prio;
+
+  for (prio = HIGH; prio >= NORMAL; prio--)
+    for (dir = SENDER; dir <= RECEIVER; dir++)
+      cond_broadcast (&bus_free[dir][prio], &bus_lock);
+}
+
+/* Makes FUNC be called with every task that leaves the bus from
+   now on, until the next init_bus().  FUNC runs in the task's
+   thread with the bus lock held, so it must not call back into
+   the bus.  A null FUNC turns tracing off; no call to the old
+   FUNC is in progress once this returns. */
+void
+bus_set_trace (bus_trace_func *func)
+{
+  lock_acquire (&bus_lock);
+  trace = func;
+  lock_release (&bus_lock);
+}
+
+/* Returns the number of tasks created by batchScheduler() that
+   have not left the bus yet. */
+unsigned
+bus_active (void)
 {
-  sema_up(&busslot);
+  unsigned cnt;
 
-  /* If the bus is empty, release the semaphore to indicate,
-     that the bus is free to use for whatever direction */
-  if (busslot.value == BUS_CAPACITY)
-    sema_up(&direction);
+  lock_acquire (&bus_lock);
+  cnt = active;
+  lock_release (&bus_lock);
+  return cnt;
+}
+
+/* Copies the arbiter statistics into *S. */
+void
+bus_get_stats (struct bus_stats *s)
+{
+  lock_acquire (&bus_lock);
+  *s = stats;
+  s->lanes = lane_cnt;
+  lock_release (&bus_lock);
 }
 
-/* Set the direction of the bus */
-void setDirection(int dir)
+/* Prints direction switches, waits per class and the makespan. */
+void
+bus_print_stats (void)
 {
-  sema_down(&varBusdir);
-  busdir = dir;
-  sema_up(&varBusdir);
+  static const char *class_name[2] = {"normal", "high"};
+  struct bus_stats s;
+  int prio;
+
+  bus_get_stats (&s);
+  printf ("Bus: %u lanes, %u direction switches, %u tasks aged, "
+          "makespan %lld cycles\n", s.lanes, s.switches, s.aged,
+          s.first_arrival < 0 ? 0 : s.last_departure - s.first_arrival);
+  for (prio = NORMAL; prio <= HIGH; prio++)
+    printf ("Bus: %s: %u tasks, mean wait %lld cycles, "
+            "max wait %lld cycles\n",
+            class_name[prio], s.tasks[prio],
+            s.tasks[prio] ? s.wait_total[prio] / s.tasks[prio] : 0,
+            s.wait_max[prio]);
 }
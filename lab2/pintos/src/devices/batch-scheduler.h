@@ -0,0 +1,60 @@
+#ifndef DEVICES_BATCH_SCHEDULER_H
+#define DEVICES_BATCH_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SENDER 0
+#define RECEIVER 1
+#define NORMAL 0
+#define HIGH 1
+
+/* Maximum number of independent lanes of the bus. */
+#define BUS_MAX_LANES 8
+
+/* A task wanting to use the bus, with its direction and priority.
+   The remaining members are filled in by the arbiter as the task
+   goes through the bus; times are in CPU cycles, as returned by
+   timer_cycles(), since a task's wait is often shorter than a
+   tick. */
+typedef struct {
+	int direction;
+	int priority;
+	int64_t arrival;              /* When the task asked for a slot. */
+	int64_t admitted;             /* When it got its slot. */
+	int64_t departed;             /* When it left the bus. */
+	unsigned order;               /* Admission order, from 0 at init_bus(). */
+	bool aged;                    /* Normal task that waited long enough
+	                                 to be treated as high priority. */
+	unsigned lane;                /* Lane the task used. */
+} task_t;
+
+/* Statistics gathered by the bus arbiter, all times in CPU
+   cycles. */
+struct bus_stats
+  {
+    unsigned lanes;               /* Number of lanes. */
+    unsigned switches;            /* Direction changes, over all lanes. */
+    unsigned aged;                /* Normal tasks promoted by aging. */
+    unsigned tasks[2];            /* Tasks served, per priority. */
+    int64_t wait_total[2];        /* Sum of waits, per priority. */
+    int64_t wait_max[2];          /* Longest wait, per priority. */
+    int64_t first_arrival;        /* When the first task arrived. */
+    int64_t last_departure;       /* When the last task left. */
+  };
+
+/* Called with each task once it has left the bus. */
+typedef void bus_trace_func (const task_t *);
+
+void init_bus (void);
+void batchScheduler (unsigned int num_tasks_send,
+                     unsigned int num_tasks_receive,
+                     unsigned int num_priority_send,
+                     unsigned int num_priority_receive);
+void bus_set_lanes (unsigned int cnt, const unsigned int *capacity);
+void bus_set_trace (bus_trace_func *);
+unsigned bus_active (void);
+void bus_get_stats (struct bus_stats *);
+void bus_print_stats (void);
+
+#endif /* devices/batch-scheduler.h */
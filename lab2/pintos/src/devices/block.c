@@ -19,6 +19,8 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long read_req_cnt;    /* Number of read requests. */
+    unsigned long long write_req_cnt;   /* Number of write requests. */
   };
 
 /* List of all block devices. */
@@ -123,6 +125,7 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
   check_sector (block, sector);
   block->ops->read (block->aux, sector, buffer);
   block->read_cnt++;
+  block->read_req_cnt++;
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -137,6 +140,67 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
   ASSERT (block->type != BLOCK_FOREIGN);
   block->ops->write (block->aux, sector, buffer);
   block->write_cnt++;
+  block->write_req_cnt++;
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK,
+   sector I into BUFFERS[I], which must have room for
+   BLOCK_SECTOR_SIZE bytes.  Uses a single request if the driver
+   supports it, which is much faster than a request per sector.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     size_t cnt, void *const buffers[])
+{
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector + cnt - 1);
+  if (block->ops->read_multiple != NULL)
+    {
+      block->ops->read_multiple (block->aux, sector, cnt, buffers);
+      block->read_req_cnt++;
+    }
+  else
+    for (i = 0; i < cnt; i++)
+      {
+        block->ops->read (block->aux, sector + i, buffers[i]);
+        block->read_req_cnt++;
+      }
+  block->read_cnt += cnt;
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK,
+   sector I from BUFFERS[I], which must contain BLOCK_SECTOR_SIZE
+   bytes.  Uses a single request if the driver supports it.
+   Returns after the block device has acknowledged receiving the
+   data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *const buffers[])
+{
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  if (block->ops->write_multiple != NULL)
+    {
+      block->ops->write_multiple (block->aux, sector, cnt, buffers);
+      block->write_req_cnt++;
+    }
+  else
+    for (i = 0; i < cnt; i++)
+      {
+        block->ops->write (block->aux, sector + i, buffers[i]);
+        block->write_req_cnt++;
+      }
+  block->write_cnt += cnt;
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -166,14 +230,16 @@ block_print_stats (void)
 {
   int i;
 
-  for (i = 0; i < BLOCK_CNT; i++)
+  for (i = 0; i < BLOCK_ROLE_CNT; i++)
     {
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
-          printf ("%s (%s): %llu reads, %llu writes\n",
+          printf ("%s (%s): %llu reads, %llu writes "
+                  "in %llu and %llu requests\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  block->read_cnt, block->write_cnt,
+                  block->read_req_cnt, block->write_req_cnt);
         }
     }
 }
@@ -200,6 +266,8 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->read_req_cnt = 0;
+  block->write_req_cnt = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
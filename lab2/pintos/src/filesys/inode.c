@@ -6,6 +6,7 @@
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -57,11 +58,30 @@ byte_to_sector (const struct inode *inode, off_t pos)
    returns the same `struct inode'. */
 static struct list open_inodes;
 
+/* Cache of `struct inode's. */
+static struct slab_cache inode_cache;
+
+static slab_ctor_func inode_ctor;
+
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
   list_init (&open_inodes);
+  slab_cache_init (&inode_cache, "inode", sizeof (struct inode),
+                   inode_ctor, NULL);
+}
+
+/* Constructs INODE_, a new member of inode_cache.  An inode goes
+   back to the cache with writes allowed and not removed, so
+   inode_open() need not set these again. */
+static void
+inode_ctor (void *inode_, void *aux UNUSED)
+{
+  struct inode *inode = inode_;
+
+  inode->deny_write_cnt = 0;
+  inode->removed = false;
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -127,7 +147,7 @@ inode_open (block_sector_t sector)
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = slab_alloc (&inode_cache);
   if (inode == NULL)
     return NULL;
 
@@ -135,8 +155,6 @@ inode_open (block_sector_t sector)
   list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
-  inode->deny_write_cnt = 0;
-  inode->removed = false;
   block_read (fs_device, inode->sector, &inode->data);
   return inode;
 }
@@ -179,9 +197,11 @@ inode_close (struct inode *inode)
           free_map_release (inode->sector, 1);
           free_map_release (inode->data.start,
                             bytes_to_sectors (inode->data.length)); 
+          inode->removed = false;
         }
 
-      free (inode); 
+      ASSERT (inode->deny_write_cnt == 0);
+      slab_free (&inode_cache, inode); 
     }
 }
 
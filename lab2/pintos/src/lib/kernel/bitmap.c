@@ -23,11 +23,25 @@ typedef unsigned long elem_type;
 
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   A bitmap may also have a summary, added with
+   bitmap_add_summary(), which is a second level of two bitmaps
+   with one bit per element: in NONZERO, whether the element has
+   any bit set, and in FULL, whether it has all of its bits set.
+   Searches use it to skip whole runs of elements that cannot
+   hold what they look for.  The summary is a conservative hint:
+   a NONZERO bit may be set for an element that is all zeros and
+   a FULL bit may be clear for one that is all ones, but not the
+   other way around, because updates to it check the element
+   again after clearing a NONZERO bit or setting a FULL bit.
+   That keeps it correct when bits are set without a lock. */
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    elem_type *nonzero; /* Summary of nonzero elements, or null. */
+    elem_type *full;    /* Summary of full elements, or null. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -68,6 +82,156 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns a bit mask in which the bits of element ELEM_IDX that
+   are within the CNT bits starting at START are set to 1 and the
+   rest are set to 0.  CNT must not be zero. */
+static inline elem_type
+range_mask (size_t elem_idx, size_t start, size_t cnt) 
+{
+  size_t first = elem_idx * ELEM_BITS;
+  size_t end = start + cnt;
+  elem_type mask = (elem_type) -1;
+
+  if (start > first)
+    mask &= (elem_type) -1 << (start - first);
+  if (end < first + ELEM_BITS)
+    mask &= ((elem_type) 1 << (end - first)) - 1;
+  return mask;
+}
+
+/* Returns the number of bits set to 1 in X.  GCC's
+   __builtin_popcountl() would need a helper function from
+   libgcc, which the kernel is not linked with. */
+static inline unsigned
+popcount (elem_type x) 
+{
+  x = x - ((x >> 1) & (elem_type) 0x5555555555555555ULL);
+  x = (x & (elem_type) 0x3333333333333333ULL)
+      + ((x >> 2) & (elem_type) 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & (elem_type) 0x0f0f0f0f0f0f0f0fULL;
+  return (x * (elem_type) 0x0101010101010101ULL) >> (ELEM_BITS - 8);
+}
+
+/* Atomically sets the bits of MASK in *ELEM to 1.
+
+   This is equivalent to `*elem |= mask' except that it is
+   guaranteed to be atomic on a uniprocessor machine.  See the
+   description of the OR instruction in [IA32-v2b]. */
+static inline void
+elem_or (elem_type *elem, elem_type mask) 
+{
+  asm ("or %1, %0" : "+m" (*elem) : "r" (mask) : "cc");
+}
+
+/* Atomically sets the bits of MASK in *ELEM to 0.
+
+   This is equivalent to `*elem &= ~mask' except that it is
+   guaranteed to be atomic on a uniprocessor machine.  See the
+   description of the AND instruction in [IA32-v2a]. */
+static inline void
+elem_and_not (elem_type *elem, elem_type mask) 
+{
+  asm ("and %1, %0" : "+m" (*elem) : "r" (~mask) : "cc");
+}
+
+/* Returns element ELEM_IDX of B, read again from memory. */
+static inline elem_type
+read_elem (const struct bitmap *b, size_t elem_idx) 
+{
+  return *(volatile const elem_type *) &b->bits[elem_idx];
+}
+
+/* Brings the summary bits of element ELEM_IDX of B up to date
+   with the element, if B has a summary.  Called after every
+   change to the element. */
+static void
+update_summary (struct bitmap *b, size_t idx) 
+{
+  elem_type used = (idx == elem_cnt (b->bit_cnt) - 1
+                    ? last_mask (b) : (elem_type) -1);
+  size_t sum_idx = elem_idx (idx);
+  elem_type sum_mask = bit_mask (idx);
+  elem_type elem;
+
+  if (b->nonzero == NULL)
+    return;
+
+  elem = read_elem (b, idx);
+  if (elem != 0)
+    elem_or (&b->nonzero[sum_idx], sum_mask);
+  else 
+    {
+      elem_and_not (&b->nonzero[sum_idx], sum_mask);
+      if (read_elem (b, idx) != 0)
+        elem_or (&b->nonzero[sum_idx], sum_mask);
+    }
+
+  if ((elem & used) != used)
+    elem_and_not (&b->full[sum_idx], sum_mask);
+  else 
+    {
+      elem_or (&b->full[sum_idx], sum_mask);
+      if ((read_elem (b, idx) & used) != used)
+        elem_and_not (&b->full[sum_idx], sum_mask);
+    }
+}
+
+/* Returns the index of the first element of B at or after
+   ELEM_IDX that may have a bit set to VALUE, according to B's
+   summary, or the number of elements in B if there is none.  If B
+   has no summary, returns ELEM_IDX. */
+static size_t
+next_elem (const struct bitmap *b, size_t idx, bool value) 
+{
+  size_t elem_total = elem_cnt (b->bit_cnt);
+  const elem_type *summary = value ? b->nonzero : b->full;
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t sum_idx;
+  elem_type sum;
+
+  if (summary == NULL || idx >= elem_total)
+    return idx < elem_total ? idx : elem_total;
+
+  sum_idx = elem_idx (idx);
+  sum = (summary[sum_idx] ^ flip) & ((elem_type) -1 << (idx % ELEM_BITS));
+  while (sum == 0)
+    {
+      if (++sum_idx >= elem_cnt (elem_total))
+        return elem_total;
+      sum = summary[sum_idx] ^ flip;
+    }
+  idx = sum_idx * ELEM_BITS + __builtin_ctzl (sum);
+  return idx < elem_total ? idx : elem_total;
+}
+
+/* Returns the index of the first bit in B at or after START that
+   is set to VALUE, or the number of bits in B if there is none.
+   Works on whole elements, skipping those that B's summary rules
+   out. */
+static size_t
+next_bit (const struct bitmap *b, size_t start, bool value) 
+{
+  size_t elem_total = elem_cnt (b->bit_cnt);
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t idx, bit_idx;
+  elem_type elem;
+
+  if (start >= b->bit_cnt)
+    return b->bit_cnt;
+
+  idx = elem_idx (start);
+  elem = (b->bits[idx] ^ flip) & ((elem_type) -1 << (start % ELEM_BITS));
+  while (elem == 0)
+    {
+      idx = next_elem (b, idx + 1, value);
+      if (idx >= elem_total)
+        return b->bit_cnt;
+      elem = b->bits[idx] ^ flip;
+    }
+  bit_idx = idx * ELEM_BITS + __builtin_ctzl (elem);
+  return bit_idx < b->bit_cnt ? bit_idx : b->bit_cnt;
+}
 
 /* Creation and destruction. */
 
@@ -83,6 +247,7 @@ bitmap_create (size_t bit_cnt)
     {
       b->bit_cnt = bit_cnt;
       b->bits = malloc (byte_cnt (bit_cnt));
+      b->nonzero = b->full = NULL;
       if (b->bits != NULL || bit_cnt == 0)
         {
           bitmap_set_all (b, false);
@@ -105,6 +270,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->nonzero = b->full = NULL;
   bitmap_set_all (b, false);
   return b;
 }
@@ -117,6 +283,29 @@ bitmap_buf_size (size_t bit_cnt)
   return sizeof (struct bitmap) + byte_cnt (bit_cnt);
 }
 
+/* Adds a summary to B, which speeds up searching B for long
+   runs of bits that are all the same, at the cost of one more
+   bit per element of B to update on every change.  Returns true
+   if successful, false if memory allocation failed, in which
+   case B works as before. */
+bool
+bitmap_add_summary (struct bitmap *b) 
+{
+  size_t idx, sum_cnt = elem_cnt (elem_cnt (b->bit_cnt));
+
+  ASSERT (b != NULL);
+  if (b->nonzero != NULL)
+    return true;
+
+  b->nonzero = calloc (2 * sum_cnt, sizeof *b->nonzero);
+  if (b->nonzero == NULL)
+    return false;
+  b->full = b->nonzero + sum_cnt;
+  for (idx = 0; idx < elem_cnt (b->bit_cnt); idx++)
+    update_summary (b, idx);
+  return true;
+}
+
 /* Destroys bitmap B, freeing its storage.
    Not for use on bitmaps created by
    bitmap_create_preallocated(). */
@@ -125,6 +314,7 @@ bitmap_destroy (struct bitmap *b)
 {
   if (b != NULL) 
     {
+      free (b->nonzero);
       free (b->bits);
       free (b);
     }
@@ -160,10 +350,8 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
 
-  /* This is equivalent to `b->bits[idx] |= mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the OR instruction in [IA32-v2b]. */
-  asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  elem_or (&b->bits[idx], mask);
+  update_summary (b, idx);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -173,10 +361,8 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
 
-  /* This is equivalent to `b->bits[idx] &= ~mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the AND instruction in [IA32-v2a]. */
-  asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  elem_and_not (&b->bits[idx], mask);
+  update_summary (b, idx);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -191,7 +377,8 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
   /* This is equivalent to `b->bits[idx] ^= mask' except that it
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
-  asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  asm ("xor %1, %0" : "+m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -214,18 +401,30 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element's bits are set atomically, but not all of them
+   at once. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t idx;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  if (cnt == 0)
+    return;
+  for (idx = elem_idx (start); idx <= elem_idx (start + cnt - 1); idx++)
+    {
+      elem_type mask = range_mask (idx, start, cnt);
+
+      if (value)
+        elem_or (&b->bits[idx], mask);
+      else
+        elem_and_not (&b->bits[idx], mask);
+      update_summary (b, idx);
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -233,17 +432,18 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t idx, true_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  if (cnt == 0)
+    return 0;
+  true_cnt = 0;
+  for (idx = elem_idx (start); idx <= elem_idx (start + cnt - 1); idx++)
+    true_cnt += popcount (b->bits[idx] & range_mask (idx, start, cnt));
+  return value ? true_cnt : cnt - true_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -251,16 +451,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return cnt > 0 && next_bit (b, start, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -292,7 +487,11 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Jumps from each run of bits set to VALUE to the next, so that
+   it takes time linear in the number of elements and runs
+   searched, rather than in the number of bits times CNT. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
@@ -302,10 +501,22 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      if (cnt == 0)
+        return start <= last ? start : BITMAP_ERROR;
+      for (;;)
+        {
+          size_t end;
+
+          i = next_bit (b, i, value);
+          if (i > last)
+            break;
+          end = next_bit (b, i, !value);
+          if (end - i >= cnt)
+            return i;
+          i = end;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -345,8 +556,12 @@ bitmap_read (struct bitmap *b, struct file *file)
   if (b->bit_cnt > 0) 
     {
       off_t size = byte_cnt (b->bit_cnt);
+      size_t idx;
+
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      for (idx = 0; idx < elem_cnt (b->bit_cnt); idx++)
+        update_summary (b, idx);
     }
   return success;
 }
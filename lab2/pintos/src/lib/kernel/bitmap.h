@@ -11,6 +11,7 @@
 struct bitmap *bitmap_create (size_t bit_cnt);
 struct bitmap *bitmap_create_in_buf (size_t bit_cnt, void *, size_t byte_cnt);
 size_t bitmap_buf_size (size_t bit_cnt);
+bool bitmap_add_summary (struct bitmap *);
 void bitmap_destroy (struct bitmap *);
 
 /* Bitmap size. */
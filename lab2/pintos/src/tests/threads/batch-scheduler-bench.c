@@ -0,0 +1,271 @@
+/* Benchmarks the batch scheduler's bus arbiter over a sweep of
+   task mixes and random seeds, a run where high priority tasks
+   keep arriving while normal tasks wait, and a comparison of a
+   single-lane bus with a multi-lane one.  Every task's wait and
+   service time is recorded in CPU cycles, since both are often
+   shorter than a timer tick, and each run prints one line of
+   KEY=VALUE pairs so that arbiter designs can be compared by
+   numbers.  Tasks that do not finish in time count as starved,
+   and normal tasks that are admitted, without having aged,
+   ahead of a high priority task that was already waiting count
+   as ordering violations; either fails the test. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <random.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/batch-scheduler.h"
+#include "devices/timer.h"
+
+/* A task mix: numbers of normal and high priority senders and
+   receivers. */
+struct mix
+  {
+    unsigned send, receive;
+    unsigned prio_send, prio_receive;
+  };
+
+static const struct mix mixes[] =
+  {
+    {1, 0, 0, 0},
+    {0, 0, 0, 1},
+    {4, 4, 0, 0},
+    {0, 0, 4, 4},
+    {8, 0, 0, 8},
+    {10, 10, 5, 5},
+    {40, 30, 0, 0},
+    {22, 22, 10, 10},
+    {100, 100, 25, 25},
+    {200, 200, 50, 50},
+  };
+
+static const unsigned seeds[] = {1, 20240607};
+
+/* Mixes run with each of the lane counts below, to compare the
+   throughput of a single-lane bus with a multi-lane one. */
+static const struct mix lane_mixes[] =
+  {
+    {100, 100, 0, 0},
+    {100, 100, 25, 25},
+  };
+
+static const unsigned lane_cnts[] = {1, 4};
+
+/* Ticks each task gets before it counts as starved. */
+#define STARVATION_TICKS 200
+
+/* Sustained load: SUSTAINED_NORMAL normal tasks in each direction
+   compete with SUSTAINED_HIGH high priority tasks per direction
+   arriving every SUSTAINED_PERIOD ticks, SUSTAINED_ROUNDS times.
+   That is more than the bus can carry, so without aging the
+   normal tasks would wait for the whole stream to end. */
+#define SUSTAINED_NORMAL 10
+#define SUSTAINED_HIGH 2
+#define SUSTAINED_PERIOD 5
+#define SUSTAINED_ROUNDS 60
+
+/* Records of the tasks that finished in the current run. */
+static struct lock records_lock;
+static task_t *records;
+static size_t record_cnt;
+
+static void record_task (const task_t *);
+static void start_run (unsigned task_cnt, unsigned seed);
+static void finish_run (const char *name, unsigned seed,
+                        unsigned task_cnt, int64_t deadline);
+static int compare_wait (const void *, const void *);
+
+void
+test_batch_scheduler_bench (void)
+{
+  char name[32];
+  size_t i, j;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  lock_init (&records_lock);
+  for (i = 0; i < sizeof mixes / sizeof *mixes; i++)
+    for (j = 0; j < sizeof seeds / sizeof *seeds; j++)
+      {
+        const struct mix *m = &mixes[i];
+        unsigned task_cnt = (m->send + m->receive
+                             + m->prio_send + m->prio_receive);
+        int64_t deadline = timer_ticks () + STARVATION_TICKS + task_cnt * 10;
+
+        start_run (task_cnt, seeds[j]);
+        batchScheduler (m->send, m->receive, m->prio_send, m->prio_receive);
+        snprintf (name, sizeof name, "%u/%u/%u/%u",
+                  m->send, m->receive, m->prio_send, m->prio_receive);
+        finish_run (name, seeds[j], task_cnt, deadline);
+      }
+
+  for (j = 0; j < sizeof seeds / sizeof *seeds; j++)
+    {
+      unsigned task_cnt = 2 * SUSTAINED_NORMAL
+                          + 2 * SUSTAINED_HIGH * (SUSTAINED_ROUNDS + 1);
+      int64_t deadline = timer_ticks () + STARVATION_TICKS + task_cnt * 10;
+
+      start_run (task_cnt, seeds[j]);
+      batchScheduler (0, 0, SUSTAINED_HIGH, SUSTAINED_HIGH);
+      batchScheduler (SUSTAINED_NORMAL, SUSTAINED_NORMAL, 0, 0);
+      for (i = 0; i < SUSTAINED_ROUNDS; i++)
+        {
+          timer_sleep (SUSTAINED_PERIOD);
+          batchScheduler (0, 0, SUSTAINED_HIGH, SUSTAINED_HIGH);
+        }
+      finish_run ("sustained", seeds[j], task_cnt, deadline);
+    }
+
+  for (i = 0; i < sizeof lane_mixes / sizeof *lane_mixes; i++)
+    for (j = 0; j < sizeof lane_cnts / sizeof *lane_cnts; j++)
+      {
+        const struct mix *m = &lane_mixes[i];
+        unsigned task_cnt = (m->send + m->receive
+                             + m->prio_send + m->prio_receive);
+        int64_t deadline = timer_ticks () + STARVATION_TICKS + task_cnt * 10;
+
+        start_run (task_cnt, seeds[0]);
+        bus_set_lanes (lane_cnts[j], NULL);
+        batchScheduler (m->send, m->receive, m->prio_send, m->prio_receive);
+        snprintf (name, sizeof name, "%u/%u/%u/%u",
+                  m->send, m->receive, m->prio_send, m->prio_receive);
+        finish_run (name, seeds[0], task_cnt, deadline);
+      }
+  pass ();
+}
+
+/* Resets the bus for a run of TASK_CNT tasks using random seed
+   SEED, and starts recording the tasks. */
+static void
+start_run (unsigned task_cnt, unsigned seed)
+{
+  records = malloc (sizeof *records * task_cnt);
+  if (records == NULL)
+    PANIC ("couldn't allocate memory for test");
+  record_cnt = 0;
+
+  init_bus ();
+  random_init (seed);
+  bus_set_trace (record_task);
+}
+
+/* Waits for the TASK_CNT tasks of run NAME to finish, giving up
+   on any still around at DEADLINE, then prints the run's
+   summary. */
+static void
+finish_run (const char *name, unsigned seed, unsigned task_cnt,
+            int64_t deadline)
+{
+  int64_t service_total[2], service_max[2], *waits;
+  unsigned cnt[2], starved, violations;
+  int64_t makespan;
+  struct bus_stats s;
+  size_t i, j;
+
+  while (bus_active () > 0 && timer_ticks () < deadline)
+    timer_sleep (10);
+  starved = bus_active ();
+  bus_get_stats (&s);
+  makespan = s.first_arrival < 0 ? 0 : s.last_departure - s.first_arrival;
+
+  waits = malloc (sizeof *waits * (record_cnt + 1));
+  if (waits == NULL)
+    PANIC ("couldn't allocate memory for test");
+
+  /* Summarize service times and find ordering violations. */
+  lock_acquire (&records_lock);
+  cnt[NORMAL] = cnt[HIGH] = 0;
+  service_total[NORMAL] = service_total[HIGH] = 0;
+  service_max[NORMAL] = service_max[HIGH] = 0;
+  for (i = 0; i < record_cnt; i++)
+    {
+      const task_t *t = &records[i];
+      int64_t service = t->departed - t->admitted;
+
+      if (t->priority == NORMAL)
+        waits[cnt[NORMAL]] = t->admitted - t->arrival;
+      cnt[t->priority]++;
+      service_total[t->priority] += service;
+      if (service > service_max[t->priority])
+        service_max[t->priority] = service;
+    }
+  violations = 0;
+  for (i = 0; i < record_cnt; i++)
+    {
+      const task_t *n = &records[i];
+
+      if (n->priority != NORMAL || n->aged)
+        continue;
+      for (j = 0; j < record_cnt; j++)
+        {
+          const task_t *h = &records[j];
+
+          if (h->priority == HIGH && h->arrival < n->admitted
+              && h->order > n->order)
+            {
+              violations++;
+              break;
+            }
+        }
+    }
+  lock_release (&records_lock);
+
+  /* Tail latency of normal tasks. */
+  waits[cnt[NORMAL]] = 0;
+  qsort (waits, cnt[NORMAL], sizeof *waits, compare_wait);
+
+  msg ("mix=%s seed=%u lanes=%u tasks=%u done=%zu starved=%u "
+       "order_violations=%u switches=%u aged=%u makespan=%lld "
+       "throughput_per_mcycles=%lld "
+       "normal_wait_mean=%lld normal_wait_p50=%lld normal_wait_p95=%lld "
+       "normal_wait_p99=%lld normal_wait_max=%lld "
+       "high_wait_mean=%lld high_wait_max=%lld "
+       "normal_service_mean=%lld normal_service_max=%lld "
+       "high_service_mean=%lld high_service_max=%lld",
+       name, seed, s.lanes, task_cnt, record_cnt, starved, violations,
+       s.switches, s.aged, makespan,
+       makespan > 0 ? (int64_t) record_cnt * 1000000 / makespan : 0,
+       s.tasks[NORMAL] ? s.wait_total[NORMAL] / s.tasks[NORMAL] : 0,
+       waits[cnt[NORMAL] ? (cnt[NORMAL] - 1) * 50 / 100 : 0],
+       waits[cnt[NORMAL] ? (cnt[NORMAL] - 1) * 95 / 100 : 0],
+       waits[cnt[NORMAL] ? (cnt[NORMAL] - 1) * 99 / 100 : 0],
+       s.wait_max[NORMAL],
+       s.tasks[HIGH] ? s.wait_total[HIGH] / s.tasks[HIGH] : 0,
+       s.wait_max[HIGH],
+       cnt[NORMAL] ? service_total[NORMAL] / cnt[NORMAL] : 0,
+       service_max[NORMAL],
+       cnt[HIGH] ? service_total[HIGH] / cnt[HIGH] : 0,
+       service_max[HIGH]);
+
+  if (starved > 0)
+    fail ("%u of %u tasks starved", starved, task_cnt);
+  if (violations > 0)
+    fail ("%u normal tasks overtook high priority tasks", violations);
+  bus_set_trace (NULL);
+  free (waits);
+  free (records);
+}
+
+/* Saves a copy of task T, which has just left the bus. */
+static void
+record_task (const task_t *t)
+{
+  lock_acquire (&records_lock);
+  records[record_cnt++] = *t;
+  lock_release (&records_lock);
+}
+
+/* Orders waits, in cycles, from shortest to longest. */
+static int
+compare_wait (const void *a_, const void *b_)
+{
+  const int64_t *a = a_;
+  const int64_t *b = b_;
+
+  return *a < *b ? -1 : *a > *b;
+}
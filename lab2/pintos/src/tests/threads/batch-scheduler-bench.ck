@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+my ($runs) = 0;
+foreach (grep (/^\(batch-scheduler-bench\) mix=/, @output)) {
+    my (%field) = /(\w+)=(\S+)/g;
+    $runs++;
+    fail "Tasks starved in run $runs: $_\n" if $field{starved} != 0;
+    fail "Ordering violated in run $runs: $_\n"
+      if $field{order_violations} != 0;
+    fail "Not all tasks finished in run $runs: $_\n"
+      if $field{done} != $field{tasks};
+}
+fail "Expected 26 benchmark runs, found $runs.\n" if $runs != 26;
+fail "Benchmark did not pass.\n"
+  if !grep (/^\(batch-scheduler-bench\) PASS$/, @output);
+pass;
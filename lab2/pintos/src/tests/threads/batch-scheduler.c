@@ -7,7 +7,7 @@
 #include "threads/synch.h"
 #include "threads/thread.h"
 
-#include "devices/batch-scheduler.c"
+#include "devices/batch-scheduler.h"
 
 
 
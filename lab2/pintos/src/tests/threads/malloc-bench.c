@@ -0,0 +1,188 @@
+/* Measures how much memory malloc() wastes on the sizes asked
+   for by the kernel's malloc() call sites.  Replays a random mix
+   of those sizes, keeping up to SLOT_CNT blocks live at a time,
+   and prints one line of KEY=VALUE pairs: the bytes requested,
+   the bytes in the blocks malloc() handed out for them, what
+   power-of-2 size classes would have handed out, the kernel pool
+   pages in use at the peak, and the resulting memory efficiency.
+   The replay is run twice; fails if the second run leaves fewer
+   pages free than the first, which would mean malloc() leaks
+   arenas. */
+
+#include <stdio.h>
+#include <list.h>
+#include <random.h>
+#include "tests/threads/tests.h"
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* The size one of the kernel's malloc() call sites asks for, with
+   its relative frequency in the replay.  Objects that come from
+   slab caches, such as struct file and struct inode, are left
+   out.  Sizes of structures private to other files are written
+   out for the 80x86.
+
+   The weights are not measured: sites that run once at boot get
+   1, the others get more the more often a user program makes
+   them run.  A kernel built with "make HEAP_PROFILE=1" prints
+   the callsites that allocate most at shutdown, which is the
+   place to check them against. */
+struct kernel_size
+  {
+    size_t size;
+    unsigned weight;
+  };
+
+static const struct kernel_size kernel_sizes[] =
+  {
+    /* filesys/inode.c: bounce buffers for partial sectors. */
+    {BLOCK_SECTOR_SIZE, 8},
+    /* filesys/inode.c: struct inode_disk, in inode_create(). */
+    {BLOCK_SECTOR_SIZE, 2},
+    /* lib/kernel/hash.c: initial buckets, in hash_init(). */
+    {4 * sizeof (struct list), 4},
+    /* lib/kernel/hash.c: buckets of a table grown to 16 and to
+       64 buckets, in rehash(). */
+    {16 * sizeof (struct list), 2},
+    {64 * sizeof (struct list), 1},
+    /* vm/share.c: struct share, one per shared page. */
+    {60, 6},
+    /* vm/mmap.c: struct mapping, in mmap_map(). */
+    {24, 2},
+    /* lib/kernel/bitmap.c: struct bitmap and the bits of the swap
+       and free maps, in bitmap_create(). */
+    {16, 1},
+    {128, 1},
+    {512, 1},
+    /* devices/block.c: struct block, in block_register(). */
+    {72, 1},
+    /* devices/partition.c: struct partition and the partition
+       table sector. */
+    {8, 1},
+    {BLOCK_SECTOR_SIZE, 1},
+  };
+
+#define SLOT_CNT 512            /* Maximum live allocations. */
+#define STEP_CNT 20000          /* Allocations and frees per run. */
+
+static struct
+  {
+    void *p;
+    size_t size;
+  }
+slots[SLOT_CNT];
+
+static size_t run_replay (unsigned run);
+static size_t pick_size (void);
+static size_t pow2_round_size (size_t);
+
+void
+test_malloc_bench (void)
+{
+  size_t first, second;
+
+  first = run_replay (1);
+  second = run_replay (2);
+  if (second < first)
+    fail ("%zu kernel pages free after second run, %zu after first",
+          second, first);
+  pass ();
+}
+
+/* Replays the call sites' sizes, prints the results as run
+   RUN, and returns the number of free kernel pages afterward. */
+static size_t
+run_replay (unsigned run)
+{
+  struct palloc_stats before, now;
+  size_t live_req = 0, live_block = 0, live_pow2 = 0;
+  size_t peak_req = 0, peak_block = 0, peak_pow2 = 0, peak_pages = 0;
+  unsigned failures = 0;
+  size_t i, step;
+
+  random_init (0x5eed);
+  palloc_get_stats (0, &before);
+  for (step = 0; step < STEP_CNT; step++)
+    {
+      i = random_ulong () % SLOT_CNT;
+      if (slots[i].p != NULL)
+        {
+          live_req -= slots[i].size;
+          live_block -= malloc_round_size (slots[i].size);
+          live_pow2 -= pow2_round_size (slots[i].size);
+          free (slots[i].p);
+          slots[i].p = NULL;
+          continue;
+        }
+
+      slots[i].size = pick_size ();
+      slots[i].p = malloc (slots[i].size);
+      if (slots[i].p == NULL)
+        {
+          failures++;
+          continue;
+        }
+      live_req += slots[i].size;
+      live_block += malloc_round_size (slots[i].size);
+      live_pow2 += pow2_round_size (slots[i].size);
+
+      palloc_get_stats (0, &now);
+      if (before.free_pages - now.free_pages > peak_pages)
+        {
+          peak_pages = before.free_pages - now.free_pages;
+          peak_req = live_req;
+          peak_block = live_block;
+          peak_pow2 = live_pow2;
+        }
+    }
+
+  for (i = 0; i < SLOT_CNT; i++)
+    if (slots[i].p != NULL)
+      {
+        free (slots[i].p);
+        slots[i].p = NULL;
+      }
+  palloc_get_stats (0, &now);
+
+  msg ("run=%u steps=%d failures=%u peak_requested_bytes=%zu "
+       "peak_block_bytes=%zu peak_pow2_block_bytes=%zu peak_pages=%zu "
+       "block_efficiency_pct=%zu pow2_block_efficiency_pct=%zu "
+       "page_efficiency_pct=%zu pages_retained=%zu",
+       run, STEP_CNT, failures, peak_req, peak_block, peak_pow2,
+       peak_pages,
+       peak_block > 0 ? peak_req * 100 / peak_block : 0,
+       peak_pow2 > 0 ? peak_req * 100 / peak_pow2 : 0,
+       peak_pages > 0 ? peak_req * 100 / (peak_pages * PGSIZE) : 0,
+       before.free_pages - now.free_pages);
+  return now.free_pages;
+}
+
+/* Returns a random size from kernel_sizes[], by weight. */
+static size_t
+pick_size (void)
+{
+  unsigned total = 0, pick;
+  size_t i;
+
+  for (i = 0; i < sizeof kernel_sizes / sizeof *kernel_sizes; i++)
+    total += kernel_sizes[i].weight;
+  pick = random_ulong () % total;
+  for (i = 0; pick >= kernel_sizes[i].weight; i++)
+    pick -= kernel_sizes[i].weight;
+  return kernel_sizes[i].size;
+}
+
+/* Returns the block size that SIZE would get with power-of-2
+   size classes from 16 to 1024 bytes. */
+static size_t
+pow2_round_size (size_t size)
+{
+  size_t block_size;
+
+  for (block_size = 16; block_size <= 1024; block_size *= 2)
+    if (block_size >= size)
+      return block_size;
+  return malloc_round_size (size);
+}
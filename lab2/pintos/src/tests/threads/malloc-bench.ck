@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+my (@runs) = grep (/^\(malloc-bench\) run=/, @output);
+fail "Expected 2 benchmark runs, found " . scalar (@runs) . ".\n"
+  if @runs != 2;
+fail "Benchmark did not pass.\n"
+  if !grep (/^\(malloc-bench\) PASS$/, @output);
+pass;
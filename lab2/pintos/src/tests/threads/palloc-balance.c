@@ -0,0 +1,104 @@
+/* Checks that the kernel and user pools borrow pages from each
+   other.  Allocates user pool pages until that fails, which must
+   happen only after the pool has gone past its own share of
+   memory, and then checks that the kernel can still allocate its
+   reserve.  Does the same with kernel pool pages, and finally
+   checks that every page came back.  Pre-zeroing is turned off
+   meanwhile, so that the idle thread does not take pages behind
+   our back. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+
+/* Pages the kernel pool keeps however many pages the user pool
+   takes.  RESERVE_MIN in threads/palloc.c. */
+#define RESERVE_PAGES 16
+
+static size_t fill (enum palloc_flags, void **pages);
+static void free_all (void *pages);
+
+void
+test_palloc_balance (void)
+{
+  struct palloc_stats before, full, after;
+  size_t zero_target, user_cnt, page_cnt, i;
+  void *pages = NULL;
+  void *reserve = NULL;
+
+  zero_target = palloc_set_zero_target (0);
+  palloc_get_stats (PAL_USER, &before);
+
+  /* Running out of memory also makes the shrinkers give back
+     whatever they can, so free pages are counted only now, with
+     the user pages still allocated. */
+  msg ("allocate user pages until that fails");
+  user_cnt = fill (PAL_USER, &pages);
+  palloc_get_stats (0, &full);
+  if (user_cnt <= before.share_pages)
+    fail ("user pool allocated %zu pages, no more than its share of %zu",
+          user_cnt, before.share_pages);
+
+  msg ("allocate kernel reserve");
+  for (i = 0; i < RESERVE_PAGES; i++)
+    {
+      void **page = palloc_get_page (0);
+      if (page == NULL)
+        fail ("kernel pool allocated only %zu of its %d reserved pages",
+              i, RESERVE_PAGES);
+      *page = reserve;
+      reserve = page;
+    }
+
+  msg ("free user pages and kernel reserve");
+  free_all (pages);
+  free_all (reserve);
+  pages = NULL;
+
+  msg ("allocate kernel pages until that fails");
+  palloc_get_stats (0, &before);
+  page_cnt = fill (0, &pages);
+  if (page_cnt <= before.share_pages)
+    fail ("kernel pool allocated %zu pages, no more than its share of %zu",
+          page_cnt, before.share_pages);
+
+  msg ("free kernel pages");
+  free_all (pages);
+  palloc_get_stats (0, &after);
+  palloc_set_zero_target (zero_target);
+
+  if (after.free_pages != full.free_pages + user_cnt)
+    fail ("%zu pages free at the end instead of %zu",
+          after.free_pages, full.free_pages + user_cnt);
+  pass ();
+}
+
+/* Allocates pages with FLAGS until that fails, linking them
+   through their first words onto *PAGES.  Returns the number of
+   pages allocated. */
+static size_t
+fill (enum palloc_flags flags, void **pages)
+{
+  size_t page_cnt;
+
+  for (page_cnt = 0; ; page_cnt++)
+    {
+      void **page = palloc_get_page (flags);
+      if (page == NULL)
+        return page_cnt;
+      *page = *pages;
+      *pages = page;
+    }
+}
+
+/* Frees PAGES and every page linked to it. */
+static void
+free_all (void *pages)
+{
+  while (pages != NULL)
+    {
+      void *next = *(void **) pages;
+      palloc_free_page (pages);
+      pages = next;
+    }
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(palloc-balance) begin
+(palloc-balance) allocate user pages until that fails
+(palloc-balance) allocate kernel reserve
+(palloc-balance) free user pages and kernel reserve
+(palloc-balance) allocate kernel pages until that fails
+(palloc-balance) free kernel pages
+(palloc-balance) PASS
+(palloc-balance) end
+EOF
+pass;
@@ -0,0 +1,118 @@
+/* Measures the page allocator under churn with mixed page counts.
+   For each mix of request sizes, allocates and frees blocks of
+   user pool pages in random order and prints one line of
+   KEY=VALUE pairs: how many operations ran per timer tick, how
+   many requests failed, how many of those failed even though the
+   pool had enough free pages in total (external fragmentation),
+   and the largest block left free after the churn.  Fails if the
+   pool does not get all of its pages back in the end.
+   Pre-zeroing is turned off meanwhile. */
+
+#include <stdio.h>
+#include <random.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+
+/* A mix of request sizes, in pages, chosen uniformly. */
+struct size_mix
+  {
+    const char *name;
+    size_t sizes[8];
+  };
+
+static const struct size_mix mixes[] =
+  {
+    {"single", {1, 1, 1, 1, 1, 1, 1, 1}},
+    {"mixed", {1, 1, 1, 2, 3, 4, 8, 16}},
+    {"large", {4, 8, 8, 16, 16, 24, 32, 64}},
+  };
+
+#define SLOT_CNT 256            /* Maximum live allocations. */
+#define STEP_CNT 20000          /* Allocations and frees per mix. */
+
+static struct
+  {
+    uint8_t *pages;
+    size_t page_cnt;
+  }
+slots[SLOT_CNT];
+
+static void run_mix (const struct size_mix *);
+
+void
+test_palloc_bench (void)
+{
+  size_t zero_target, i;
+
+  /* Keep the idle thread from taking pages for pre-zeroing
+     behind our back. */
+  zero_target = palloc_set_zero_target (0);
+  random_init (0x5eed);
+  for (i = 0; i < sizeof mixes / sizeof *mixes; i++)
+    run_mix (&mixes[i]);
+  palloc_set_zero_target (zero_target);
+  pass ();
+}
+
+static void
+run_mix (const struct size_mix *m)
+{
+  struct palloc_stats before, now;
+  unsigned allocs = 0, frees = 0, failures = 0, fragmented = 0;
+  int64_t start, ticks;
+  size_t i, step;
+
+  palloc_get_stats (PAL_USER, &before);
+  start = timer_ticks ();
+  for (step = 0; step < STEP_CNT; step++)
+    {
+      i = random_ulong () % SLOT_CNT;
+      if (slots[i].pages != NULL)
+        {
+          palloc_free_multiple (slots[i].pages, slots[i].page_cnt);
+          slots[i].pages = NULL;
+          frees++;
+        }
+      else
+        {
+          size_t page_cnt = m->sizes[random_ulong () % 8];
+
+          slots[i].pages = palloc_get_multiple (PAL_USER, page_cnt);
+          if (slots[i].pages == NULL)
+            {
+              palloc_get_stats (PAL_USER, &now);
+              failures++;
+              if (now.free_pages >= page_cnt)
+                fragmented++;
+              continue;
+            }
+          slots[i].page_cnt = page_cnt;
+          slots[i].pages[0] = 1;
+          allocs++;
+        }
+    }
+  ticks = timer_elapsed (start);
+  palloc_get_stats (PAL_USER, &now);
+
+  for (i = 0; i < SLOT_CNT; i++)
+    if (slots[i].pages != NULL)
+      {
+        palloc_free_multiple (slots[i].pages, slots[i].page_cnt);
+        slots[i].pages = NULL;
+      }
+
+  msg ("mix=%s pool_pages=%zu allocs=%u frees=%u ticks=%lld "
+       "ops_per_tick=%lld failures=%u failures_with_space=%u "
+       "free_after=%zu largest_free_after=%zu",
+       m->name, before.free_pages, allocs, frees, ticks,
+       (int64_t) (allocs + frees) / (ticks > 0 ? ticks : 1),
+       failures, fragmented, now.free_pages, now.largest_free);
+
+  palloc_get_stats (PAL_USER, &now);
+  if (now.free_pages != before.free_pages
+      || now.largest_free != before.largest_free)
+    fail ("%zu of %zu pages free after freeing everything",
+          now.free_pages, before.free_pages);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+my (@runs) = grep (/^\(palloc-bench\) mix=/, @output);
+fail "Expected 3 benchmark runs, found " . scalar (@runs) . ".\n"
+  if @runs != 3;
+fail "Benchmark did not pass.\n"
+  if !grep (/^\(palloc-bench\) PASS$/, @output);
+pass;
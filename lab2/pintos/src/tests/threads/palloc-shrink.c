@@ -0,0 +1,79 @@
+/* Checks that the page allocator gets memory back from caches
+   before it fails.  Fills a cache of kernel pages that has a
+   shrinker, then allocates user pool pages until that fails.
+   By then the shrinker must have given back every page of the
+   cache.  Pre-zeroing is turned off meanwhile, so that the idle
+   thread does not take pages behind our back. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+
+/* Pages in the cache. */
+#define CACHE_PAGES 64
+
+/* The cache: kernel pages linked through their first words. */
+static void *cache;
+static size_t cache_cnt;
+static struct shrinker shrinker;
+
+static size_t shrink_cache (struct shrinker *, size_t page_cnt);
+
+void
+test_palloc_shrink (void)
+{
+  size_t zero_target;
+  void *pages = NULL;
+
+  zero_target = palloc_set_zero_target (0);
+
+  msg ("fill cache");
+  for (cache_cnt = 0; cache_cnt < CACHE_PAGES; cache_cnt++)
+    {
+      void **page = palloc_get_page (PAL_ASSERT);
+      *page = cache;
+      cache = page;
+    }
+  palloc_register_shrinker (&shrinker, "test cache", -1, shrink_cache);
+
+  msg ("allocate user pages until that fails");
+  for (;;)
+    {
+      void **page = palloc_get_page (PAL_USER);
+      if (page == NULL)
+        break;
+      *page = pages;
+      pages = page;
+    }
+  palloc_unregister_shrinker (&shrinker);
+
+  msg ("free user pages");
+  while (pages != NULL)
+    {
+      void *next = *(void **) pages;
+      palloc_free_page (pages);
+      pages = next;
+    }
+  palloc_set_zero_target (zero_target);
+
+  if (cache_cnt != 0)
+    fail ("%zu of %d cache pages not reclaimed", cache_cnt, CACHE_PAGES);
+  pass ();
+}
+
+/* Frees up to PAGE_CNT pages of the cache. */
+static size_t
+shrink_cache (struct shrinker *s UNUSED, size_t page_cnt)
+{
+  size_t freed = 0;
+
+  while (cache != NULL && freed < page_cnt)
+    {
+      void *next = *(void **) cache;
+      palloc_free_page (cache);
+      cache = next;
+      cache_cnt--;
+      freed++;
+    }
+  return freed;
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(palloc-shrink) begin
+(palloc-shrink) fill cache
+(palloc-shrink) allocate user pages until that fails
+(palloc-shrink) free user pages
+(palloc-shrink) PASS
+(palloc-shrink) end
+EOF
+pass;
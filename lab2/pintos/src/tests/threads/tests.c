@@ -17,6 +17,11 @@ static const struct test tests[] =
     {"alarm-zero", test_alarm_zero},
     {"alarm-negative", test_alarm_negative},
     {"batch-scheduler", test_batch_scheduler},
+    {"batch-scheduler-bench", test_batch_scheduler_bench},
+    {"palloc-bench", test_palloc_bench},
+    {"malloc-bench", test_malloc_bench},
+    {"palloc-balance", test_palloc_balance},
+    {"palloc-shrink", test_palloc_shrink},
   };
 
 static const char *test_name;
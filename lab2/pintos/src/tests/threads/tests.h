@@ -13,6 +13,11 @@ extern test_func test_alarm_negative;
 /*extern test_func test_producer_consumer;
 extern test_func test_narrow_bridge;*/
 extern test_func test_batch_scheduler;
+extern test_func test_batch_scheduler_bench;
+extern test_func test_palloc_bench;
+extern test_func test_malloc_bench;
+extern test_func test_palloc_balance;
+extern test_func test_palloc_shrink;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
@@ -0,0 +1,356 @@
+#include "threads/heapprof.h"
+
+#ifdef HEAP_PROFILE
+#include <debug.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+
+/* Kernel heap profiler.
+
+   Every live allocation from malloc() or the page allocator is
+   recorded in a fixed-size hash table, keyed by its address,
+   along with the code address that asked for it, its size and
+   the timer tick it was made at.  Allocations are also tallied
+   per callsite, that is, per caller and allocator.  The tables
+   are static, so the profiler itself never allocates memory,
+   and are protected by turning interrupts off, so that they can
+   be updated from inside the allocators' own critical sections.
+
+   At shutdown, heapprof_print_stats() lists the callsites
+   holding the most memory, the ones allocating fastest, and
+   the ones whose allocations made after heapprof_mark() are
+   still live, which are likely leaks.  It ends with a line of
+   the callsites' addresses that utils/backtrace turns into
+   function names and line numbers:
+
+        backtrace kernel.o Heap callsites: 0xc0021234 ...  */
+
+/* Number of live allocations that can be tracked.  Further
+   allocations are counted as dropped and not tracked. */
+#define REC_CNT 4096
+
+/* Number of callsites that can be tracked. */
+#define SITE_CNT 256
+
+/* Number of callsites in each list of the report. */
+#define TOP_CNT 10
+
+/* Marks a record whose allocation was freed. */
+#define REC_DELETED ((void *) 1)
+
+/* A live allocation. */
+struct rec
+  {
+    void *ptr;                  /* Address, null if slot unused. */
+    struct site *site;          /* Callsite that allocated it. */
+    size_t size;                /* Size in bytes. */
+    int64_t time;               /* Timer tick of allocation. */
+  };
+
+/* A callsite. */
+struct site
+  {
+    void *caller;               /* Code address, null if unused. */
+    enum heapprof_kind kind;    /* Allocator. */
+    size_t live_cnt;            /* Live allocations. */
+    size_t live_bytes;          /* Bytes in live allocations. */
+    unsigned long long alloc_cnt;   /* Allocations ever made. */
+    unsigned long long alloc_bytes; /* Bytes ever allocated. */
+    size_t leak_cnt;            /* Live allocations made since mark. */
+    size_t leak_bytes;          /* Bytes in those allocations. */
+    int64_t oldest_leak;        /* Tick of oldest of those. */
+    bool shown;                 /* Already in the list being printed? */
+  };
+
+static struct rec recs[REC_CNT];
+static struct site sites[SITE_CNT];
+static unsigned dropped;        /* Allocations not tracked. */
+static int64_t mark_time = -1;  /* Tick of heapprof_mark(). */
+
+static struct rec *find_rec (void *ptr, bool insert);
+static struct site *find_site (enum heapprof_kind, void *caller);
+static unsigned hash_ptr (const void *);
+static void print_top (const char *title, enum heapprof_kind,
+                       unsigned long long (*key) (const struct site *));
+static unsigned long long live_bytes_key (const struct site *);
+static unsigned long long alloc_cnt_key (const struct site *);
+static unsigned long long leak_bytes_key (const struct site *);
+
+/* Records that CALLER allocated SIZE bytes at PTR with the
+   allocator of the given KIND.  Does nothing if PTR is null. */
+void
+heapprof_alloc (enum heapprof_kind kind, void *ptr, size_t size,
+                void *caller)
+{
+  enum intr_level old_level;
+  struct site *site;
+  struct rec *r;
+
+  if (ptr == NULL)
+    return;
+
+  old_level = intr_disable ();
+  site = find_site (kind, caller);
+  r = find_rec (ptr, true);
+  if (site != NULL && r != NULL)
+    {
+      r->ptr = ptr;
+      r->site = site;
+      r->size = size;
+      r->time = timer_ticks ();
+      site->live_cnt++;
+      site->live_bytes += size;
+      site->alloc_cnt++;
+      site->alloc_bytes += size;
+    }
+  else
+    dropped++;
+  intr_set_level (old_level);
+}
+
+/* Attributes the allocation at PTR to CALLER instead, for
+   allocation functions that are built on other ones.  Does
+   nothing if PTR is null or not tracked. */
+void
+heapprof_set_caller (void *ptr, void *caller)
+{
+  enum intr_level old_level;
+  struct rec *r;
+
+  if (ptr == NULL)
+    return;
+
+  old_level = intr_disable ();
+  r = find_rec (ptr, false);
+  if (r != NULL)
+    {
+      struct site *site = find_site (r->site->kind, caller);
+      if (site != NULL)
+        {
+          r->site->live_cnt--;
+          r->site->live_bytes -= r->size;
+          r->site->alloc_cnt--;
+          r->site->alloc_bytes -= r->size;
+          r->site = site;
+          site->live_cnt++;
+          site->live_bytes += r->size;
+          site->alloc_cnt++;
+          site->alloc_bytes += r->size;
+        }
+    }
+  intr_set_level (old_level);
+}
+
+/* Records that the allocation at PTR was freed.  Does nothing
+   if PTR is null or not tracked. */
+void
+heapprof_free (void *ptr)
+{
+  enum intr_level old_level;
+  struct rec *r;
+
+  if (ptr == NULL)
+    return;
+
+  old_level = intr_disable ();
+  r = find_rec (ptr, false);
+  if (r != NULL)
+    {
+      r->site->live_cnt--;
+      r->site->live_bytes -= r->size;
+      r->ptr = REC_DELETED;
+    }
+  intr_set_level (old_level);
+}
+
+/* Marks the end of kernel initialization.  Allocations made
+   from now on that are still live at shutdown are reported as
+   leaks. */
+void
+heapprof_mark (void)
+{
+  mark_time = timer_ticks ();
+}
+
+/* Prints the heap profile. */
+void
+heapprof_print_stats (void)
+{
+  size_t live_cnt = 0, live_bytes = 0;
+  bool any_site = false;
+  size_t i;
+
+  for (i = 0; i < SITE_CNT; i++)
+    {
+      struct site *s = &sites[i];
+      s->leak_cnt = s->leak_bytes = 0;
+      s->oldest_leak = INT64_MAX;
+    }
+  for (i = 0; i < REC_CNT; i++)
+    {
+      struct rec *r = &recs[i];
+      if (r->ptr == NULL || r->ptr == REC_DELETED)
+        continue;
+      live_cnt++;
+      live_bytes += r->size;
+      if (mark_time >= 0 && r->time >= mark_time)
+        {
+          r->site->leak_cnt++;
+          r->site->leak_bytes += r->size;
+          if (r->time < r->site->oldest_leak)
+            r->site->oldest_leak = r->time;
+        }
+    }
+
+  printf ("Heap profile: %zu live allocations, %zu bytes, "
+          "%u not tracked, over %"PRId64" ticks\n",
+          live_cnt, live_bytes, dropped, timer_ticks ());
+  print_top ("malloc live bytes", HEAPPROF_MALLOC, live_bytes_key);
+  print_top ("malloc allocations", HEAPPROF_MALLOC, alloc_cnt_key);
+  print_top ("malloc leaks", HEAPPROF_MALLOC, leak_bytes_key);
+  print_top ("palloc live bytes", HEAPPROF_PALLOC, live_bytes_key);
+  print_top ("palloc allocations", HEAPPROF_PALLOC, alloc_cnt_key);
+  print_top ("palloc leaks", HEAPPROF_PALLOC, leak_bytes_key);
+
+  printf ("Heap callsites:");
+  for (i = 0; i < SITE_CNT; i++)
+    if (sites[i].caller != NULL && sites[i].alloc_cnt > 0)
+      {
+        printf (" %p", sites[i].caller);
+        any_site = true;
+      }
+  printf ("%s\n", any_site ? "" : " none");
+}
+
+/* Prints up to TOP_CNT callsites of the given KIND with the
+   largest nonzero values of KEY, under TITLE. */
+static void
+print_top (const char *title, enum heapprof_kind kind,
+           unsigned long long (*key) (const struct site *))
+{
+  int64_t ticks = timer_ticks ();
+  size_t printed, i;
+
+  for (i = 0; i < SITE_CNT; i++)
+    sites[i].shown = false;
+
+  printf ("Heap top %s:\n", title);
+  for (printed = 0; printed < TOP_CNT; printed++)
+    {
+      struct site *best = NULL;
+
+      /* Find the callsite not yet shown with the largest key. */
+      for (i = 0; i < SITE_CNT; i++)
+        {
+          struct site *s = &sites[i];
+
+          if (s->caller != NULL && s->kind == kind && !s->shown
+              && key (s) > 0 && (best == NULL || key (s) > key (best)))
+            best = s;
+        }
+      if (best == NULL)
+        break;
+      best->shown = true;
+
+      printf ("  %p: %zu live, %zu bytes; %llu allocs, %llu bytes, "
+              "%llu per kticks",
+              best->caller, best->live_cnt, best->live_bytes,
+              best->alloc_cnt, best->alloc_bytes,
+              ticks > 0 ? best->alloc_cnt * 1000 / ticks : best->alloc_cnt);
+      if (best->leak_cnt > 0)
+        printf ("; %zu leaked, %zu bytes, oldest at tick %"PRId64,
+                best->leak_cnt, best->leak_bytes, best->oldest_leak);
+      printf ("\n");
+    }
+}
+
+static unsigned long long
+live_bytes_key (const struct site *s)
+{
+  return s->live_bytes;
+}
+
+static unsigned long long
+alloc_cnt_key (const struct site *s)
+{
+  return s->alloc_cnt;
+}
+
+static unsigned long long
+leak_bytes_key (const struct site *s)
+{
+  return s->leak_bytes;
+}
+
+/* Returns the record for PTR, or a null pointer if there is
+   none.  If INSERT is true and there is no record for PTR,
+   returns a free slot for a new one instead, or a null pointer
+   if the table is full.  Interrupts must be off. */
+static struct rec *
+find_rec (void *ptr, bool insert)
+{
+  struct rec *free_slot = NULL;
+  unsigned i, idx;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  idx = hash_ptr (ptr) % REC_CNT;
+  for (i = 0; i < REC_CNT; i++, idx = (idx + 1) % REC_CNT)
+    {
+      struct rec *r = &recs[idx];
+
+      if (r->ptr == ptr)
+        return insert ? NULL : r;
+      else if (r->ptr == REC_DELETED)
+        {
+          if (free_slot == NULL)
+            free_slot = r;
+        }
+      else if (r->ptr == NULL)
+        return insert ? (free_slot != NULL ? free_slot : r) : NULL;
+    }
+  return insert ? free_slot : NULL;
+}
+
+/* Returns the callsite for CALLER with the given KIND, creating
+   it if necessary.  Returns a null pointer if the table is
+   full.  Interrupts must be off. */
+static struct site *
+find_site (enum heapprof_kind kind, void *caller)
+{
+  unsigned i, idx;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (caller != NULL);
+
+  idx = (hash_ptr (caller) + kind) % SITE_CNT;
+  for (i = 0; i < SITE_CNT; i++, idx = (idx + 1) % SITE_CNT)
+    {
+      struct site *s = &sites[idx];
+
+      if (s->caller == caller && s->kind == kind)
+        return s;
+      else if (s->caller == NULL)
+        {
+          s->caller = caller;
+          s->kind = kind;
+          return s;
+        }
+    }
+  return NULL;
+}
+
+/* Returns a hash of pointer P.  Folds the high bits of the
+   product down, because the low bits of page addresses are all
+   zero. */
+static unsigned
+hash_ptr (const void *p)
+{
+  unsigned h = ((uintptr_t) p >> 2) * 2654435761u;
+  return h ^ (h >> 16);
+}
+#endif /* HEAP_PROFILE */
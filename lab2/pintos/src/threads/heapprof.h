@@ -0,0 +1,37 @@
+#ifndef THREADS_HEAPPROF_H
+#define THREADS_HEAPPROF_H
+
+#include <stddef.h>
+
+/* Kernel heap profiler.
+
+   Built into the kernel only if HEAP_PROFILE is defined, which
+   "make HEAP_PROFILE=1" does.  Otherwise every hook below
+   expands to nothing. */
+
+/* Which allocator an allocation came from. */
+enum heapprof_kind
+  {
+    HEAPPROF_MALLOC,            /* malloc() and friends. */
+    HEAPPROF_PALLOC             /* Page allocator. */
+  };
+
+#ifdef HEAP_PROFILE
+void heapprof_alloc (enum heapprof_kind, void *, size_t size, void *caller);
+void heapprof_set_caller (void *, void *caller);
+void heapprof_free (void *);
+void heapprof_mark (void);
+void heapprof_print_stats (void);
+#else
+#define heapprof_alloc(KIND, PTR, SIZE, CALLER) ((void) 0)
+#define heapprof_set_caller(PTR, CALLER) ((void) 0)
+#define heapprof_free(PTR) ((void) 0)
+#define heapprof_mark() ((void) 0)
+#define heapprof_print_stats() ((void) 0)
+#endif
+
+/* Address that the function calling this macro returns to, to
+   record as the caller of an allocation. */
+#define HEAPPROF_CALLER __builtin_return_address (0)
+
+#endif /* threads/heapprof.h */
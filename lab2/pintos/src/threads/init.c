@@ -15,13 +15,24 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/heapprof.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
+#include "threads/vmalloc.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/merge.h"
+#include "vm/page.h"
+#include "vm/share.h"
+#include "vm/swap.h"
+#include "vm/wset.h"
+#endif
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -57,12 +68,19 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* -sp: Map kernel memory with 4 kB pages only? */
+static bool small_pages;
+
 static void bss_init (void);
 static void paging_init (void);
+static bool cpu_has_pse (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
 static void run_actions (char **argv);
+#ifdef VM
+static void print_vm_stats (char **argv);
+#endif
 static void usage (void);
 
 #ifdef FILESYS
@@ -97,7 +115,9 @@ main (void)
   /* Initialize memory system. */
   palloc_init (user_page_limit);
   malloc_init ();
+  slab_init ();
   paging_init ();
+  vmalloc_init ();
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -114,6 +134,11 @@ main (void)
   exception_init ();
   syscall_init ();
 #endif
+#ifdef VM
+  frame_init ();
+  page_init ();
+  share_init ();
+#endif
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
@@ -126,10 +151,16 @@ main (void)
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
+#ifdef VM
+  swap_init ();
+  merge_init ();
+  wset_init ();
+#endif
 
   printf ("Boot complete.\n");
   
   /* Run actions specified on kernel command line. */
+  heapprof_mark ();
   run_actions (argv);
 
   /* Finish up. */
@@ -150,19 +181,35 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* Page size extension (PSE): 4 MB pages.  See [IA32-v3a] 2.5
+   "Control Registers" and [IA32-v2a] "CPUID--CPU
+   Identification". */
+#define CR4_PSE 0x00000010      /* CR4 bit that enables PSE. */
+#define CPUID_PSE 0x00000008    /* CPUID 1 EDX bit: PSE supported. */
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU supports it, and the -sp option was not given, each
+   whole 4 MB of RAM is mapped with a single large page instead
+   of a page table of 4 kB pages, so that kernel code touching
+   lots of memory needs far fewer TLB entries.  The 4 MB that hold
+   the kernel's code still use 4 kB pages, so that the code can be
+   mapped read-only, as can the tail of RAM that does not fill a
+   large page. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
-  size_t page;
+  size_t page, large_cnt, pt_cnt;
+  bool use_pse = !small_pages && cpu_has_pse ();
   extern char _start, _end_kernel_text;
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
+  large_cnt = pt_cnt = 0;
   for (page = 0; page < init_ram_pages; page++)
     {
       uintptr_t paddr = page * PGSIZE;
@@ -171,21 +218,54 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (use_pse && pte_idx == 0
+          && init_ram_pages - page >= PTSPAN / PGSIZE
+          && !(&_start < vaddr + PTSPAN && vaddr < &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_large (vaddr, true);
+          page += PTSPAN / PGSIZE - 1;
+          large_cnt++;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
+          pt_cnt++;
         }
 
       pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
     }
 
+  /* Large pages in a page directory are treated as page tables
+     until PSE is enabled, so do that first. */
+  if (use_pse)
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0; orl %1, %0; movl %0, %%cr4"
+                    : "=&r" (cr4) : "i" (CR4_PSE));
+    }
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+
+  printf ("Kernel memory mapped with %zu 4 MB pages and %zu page tables.\n",
+          large_cnt, pt_cnt);
+}
+
+/* Returns true if the CPU supports 4 MB pages. */
+static bool
+cpu_has_pse (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return (edx & CPUID_PSE) != 0;
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -256,9 +336,19 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
-#ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-zp"))
+        palloc_set_zero_target (atoi (value));
+      else if (!strcmp (name, "-sp"))
+        small_pages = true;
+#ifdef VM
+      else if (!strcmp (name, "-sl"))
+        page_set_stack_limit (atoi (value));
+      else if (!strcmp (name, "-mg"))
+        merge_set_rate (atoi (value));
+      else if (!strcmp (name, "-ws"))
+        wset_set_interval (atoi (value));
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -292,6 +382,22 @@ run_task (char **argv)
   printf ("Execution of '%s' complete.\n", task);
 }
 
+#ifdef VM
+/* Prints the working sets of the running processes and the
+   statistics of the virtual memory system so far. */
+static void
+print_vm_stats (char **argv UNUSED)
+{
+  wset_print_all ();
+  wset_print_stats ();
+  page_print_stats ();
+  frame_print_stats ();
+  share_print_stats ();
+  merge_print_stats ();
+  swap_print_stats ();
+}
+#endif
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -309,6 +415,9 @@ run_actions (char **argv)
   static const struct action actions[] = 
     {
       {"run", 2, run_task},
+#ifdef VM
+      {"stats", 1, print_vm_stats},
+#endif
 #ifdef FILESYS
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
@@ -357,6 +466,9 @@ usage (void)
 #else
           "  run TEST           Run TEST.\n"
 #endif
+#ifdef VM
+          "  stats              Print working sets and paging statistics.\n"
+#endif
 #ifdef FILESYS
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
@@ -379,8 +491,14 @@ usage (void)
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
-#ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -zp=COUNT          Keep COUNT pre-zeroed pages (0=off).\n"
+          "  -sp                Map kernel memory with 4 kB pages only.\n"
+#ifdef VM
+          "  -sl=COUNT          Limit user stacks to COUNT pages.\n"
+          "  -mg=COUNT          Merge identical user pages, scanning\n"
+          "                     COUNT pages a second (0=off).\n"
+          "  -ws=TICKS          Sample working sets every TICKS ticks.\n"
 #endif
           );
   shutdown_power_off ();
@@ -5,17 +5,23 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/heapprof.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "threads/vmalloc.h"
 
 /* A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
-   satisfy the request.
+   The size of each request, in bytes, is rounded up to the next
+   size class and assigned to the "descriptor" that manages
+   blocks of that size.  Each size class is the largest block
+   size that fits a given number of blocks into an arena, and
+   the classes are spaced no more than 1.25x apart where the
+   arena size allows, so that most requests waste less than a
+   fifth of their block.  The descriptor keeps a list of free
+   blocks.  If the free list is nonempty, one of its blocks is
+   used to satisfy the request.
 
    Otherwise, a new page of memory, called an "arena", is
    obtained from the page allocator (if none is available,
@@ -26,13 +32,20 @@
    When we free a block, we add it to its descriptor's free list.
    But if the arena that the block was in now has no in-use
    blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
+   and give the arena back to the page allocator.  Each
+   descriptor keeps one such empty arena around, though, so that
+   a size that is allocated and freed over and over does not
+   go to the page allocator every time.  The page allocator takes
+   those back through a shrinker when it runs short of memory.
 
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.  If the
+   page allocator has no run of pages that long, we fall back
+   to mapping scattered pages contiguously with
+   vmalloc_pages(). */
 
 /* Descriptor. */
 struct desc
@@ -40,6 +53,7 @@ struct desc
     size_t block_size;          /* Size of each element in bytes. */
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
+    size_t empty_cnt;           /* Number of arenas with no used blocks. */
     struct lock lock;           /* Lock. */
   };
 
@@ -60,28 +74,79 @@ struct block
     struct list_elem free_elem; /* Free list element. */
   };
 
+/* Most that a size class may be larger than the one before it,
+   in percent. */
+#define CLASS_GROWTH 125
+
+/* Granularity of size classes, in bytes. */
+#define CLASS_ALIGN 8
+
+/* Largest size that fits two blocks in an arena, the largest
+   size class. */
+#define MAX_CLASS_SIZE \
+  ROUND_DOWN ((PGSIZE - sizeof (struct arena)) / 2, CLASS_ALIGN)
+
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[32];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Maps a request of SIZE bytes, 0 < SIZE <= MAX_CLASS_SIZE, to
+   the index in descs[] of its descriptor, at
+   class_map[DIV_ROUND_UP (SIZE, CLASS_ALIGN)]. */
+static uint8_t class_map[MAX_CLASS_SIZE / CLASS_ALIGN + 1];
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static void free_arena (struct desc *, struct arena *);
+static size_t shrink_arenas (struct shrinker *, size_t page_cnt);
+
+/* Gives empty arenas back under memory pressure. */
+static struct shrinker malloc_shrinker;
 
 /* Initializes the malloc() descriptors. */
 void
 malloc_init (void) 
 {
-  size_t block_size;
+  const size_t arena_space = PGSIZE - sizeof (struct arena);
+  size_t blocks_per_arena, size, i;
+
+  /* Each number of blocks per arena gives one candidate class,
+     the largest block size that fits that many blocks.  Going
+     from small blocks to large, take a candidate whenever
+     skipping it would make the next class more than
+     CLASS_GROWTH percent larger than the last one. */
+  for (blocks_per_arena = arena_space / 16; blocks_per_arena >= 2;
+       blocks_per_arena--)
+    {
+      size_t block_size = ROUND_DOWN (arena_space / blocks_per_arena,
+                                      CLASS_ALIGN);
+      size_t next_size = ROUND_DOWN (arena_space / (blocks_per_arena - 1),
+                                     CLASS_ALIGN);
+      size_t last_size = desc_cnt > 0 ? descs[desc_cnt - 1].block_size : 0;
+
+      if (block_size != last_size
+          && (desc_cnt == 0 || blocks_per_arena == 2
+              || next_size > last_size * CLASS_GROWTH / 100))
+        {
+          struct desc *d = &descs[desc_cnt++];
+          ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
+          d->block_size = block_size;
+          d->blocks_per_arena = blocks_per_arena;
+          list_init (&d->free_list);
+          d->empty_cnt = 0;
+          lock_init (&d->lock);
+        }
+    }
 
-  for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
+  /* Fill in the size class lookup table. */
+  for (i = 0, size = 0; size < sizeof class_map; size++)
     {
-      struct desc *d = &descs[desc_cnt++];
-      ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-      d->block_size = block_size;
-      d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
-      list_init (&d->free_list);
-      lock_init (&d->lock);
+      while (descs[i].block_size < size * CLASS_ALIGN)
+        i++;
+      class_map[size] = i;
     }
+
+  palloc_register_shrinker (&malloc_shrinker, "malloc", 1, shrink_arenas);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -97,17 +162,18 @@ malloc (size_t size)
   if (size == 0)
     return NULL;
 
-  /* Find the smallest descriptor that satisfies a SIZE-byte
-     request. */
-  for (d = descs; d < descs + desc_cnt; d++)
-    if (d->block_size >= size)
-      break;
-  if (d == descs + desc_cnt) 
+  if (size > MAX_CLASS_SIZE) 
     {
       /* SIZE is too big for any descriptor.
          Allocate enough pages to hold SIZE plus an arena. */
       size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
       a = palloc_get_multiple (0, page_cnt);
+      if (a == NULL && page_cnt > 1)
+        {
+          /* No run of PAGE_CNT free pages, so map scattered
+             ones contiguously instead. */
+          a = vmalloc_pages (page_cnt);
+        }
       if (a == NULL)
         return NULL;
 
@@ -116,9 +182,13 @@ malloc (size_t size)
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
       a->free_cnt = page_cnt;
+      heapprof_alloc (HEAPPROF_MALLOC, a + 1, size, HEAPPROF_CALLER);
       return a + 1;
     }
 
+  /* Look up the smallest descriptor that satisfies a SIZE-byte
+     request. */
+  d = &descs[class_map[DIV_ROUND_UP (size, CLASS_ALIGN)]];
   lock_acquire (&d->lock);
 
   /* If the free list is empty, create a new arena. */
@@ -138,6 +208,7 @@ malloc (size_t size)
       a->magic = ARENA_MAGIC;
       a->desc = d;
       a->free_cnt = d->blocks_per_arena;
+      d->empty_cnt++;
       for (i = 0; i < d->blocks_per_arena; i++) 
         {
           struct block *b = arena_to_block (a, i);
@@ -148,8 +219,10 @@ malloc (size_t size)
   /* Get a block from free list and return it. */
   b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
   a = block_to_arena (b);
-  a->free_cnt--;
+  if (a->free_cnt-- == d->blocks_per_arena)
+    d->empty_cnt--;
   lock_release (&d->lock);
+  heapprof_alloc (HEAPPROF_MALLOC, b, size, HEAPPROF_CALLER);
   return b;
 }
 
@@ -170,10 +243,24 @@ calloc (size_t a, size_t b)
   p = malloc (size);
   if (p != NULL)
     memset (p, 0, size);
+  heapprof_set_caller (p, HEAPPROF_CALLER);
 
   return p;
 }
 
+/* Returns the number of bytes that malloc(SIZE) takes from the
+   page allocator for its block, not counting arena headers. */
+size_t
+malloc_round_size (size_t size)
+{
+  if (size == 0)
+    return 0;
+  else if (size <= MAX_CLASS_SIZE)
+    return descs[class_map[DIV_ROUND_UP (size, CLASS_ALIGN)]].block_size;
+  else
+    return DIV_ROUND_UP (size + sizeof (struct arena), PGSIZE) * PGSIZE;
+}
+
 /* Returns the number of bytes allocated for BLOCK. */
 static size_t
 block_size (void *block) 
@@ -209,6 +296,7 @@ realloc (void *old_block, size_t new_size)
           memcpy (new_block, old_block, min_size);
           free (old_block);
         }
+      heapprof_set_caller (new_block, HEAPPROF_CALLER);
       return new_block;
     }
 }
@@ -223,7 +311,8 @@ free (void *p)
       struct block *b = p;
       struct arena *a = block_to_arena (b);
       struct desc *d = a->desc;
-      
+
+      heapprof_free (p);
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
@@ -238,18 +327,13 @@ free (void *p)
           /* Add block to free list. */
           list_push_front (&d->free_list, &b->free_elem);
 
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
+          /* If the arena is now entirely unused, free it, unless
+             it is the only empty arena of its descriptor. */
+          if (++a->free_cnt >= d->blocks_per_arena
+              && d->empty_cnt++ > 0) 
             {
-              size_t i;
-
               ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
+              free_arena (d, a);
             }
 
           lock_release (&d->lock);
@@ -257,12 +341,70 @@ free (void *p)
       else
         {
           /* It's a big block.  Free its pages. */
-          palloc_free_multiple (a, a->free_cnt);
+          if (is_vmalloc_vaddr (a))
+            vfree_pages (a, a->free_cnt);
+          else
+            palloc_free_multiple (a, a->free_cnt);
           return;
         }
     }
 }
 
+/* Removes the blocks of A, an empty arena of D, from D's free
+   list and gives A back to the page allocator.  D's lock must be
+   held. */
+static void
+free_arena (struct desc *d, struct arena *a)
+{
+  size_t i;
+
+  d->empty_cnt--;
+  for (i = 0; i < d->blocks_per_arena; i++) 
+    {
+      struct block *b = arena_to_block (a, i);
+      list_remove (&b->free_elem);
+    }
+  palloc_free_page (a);
+}
+
+/* Frees up to PAGE_CNT empty arenas of descriptors whose locks
+   are free, and returns the number freed.  Called by the page
+   allocator when it runs short of memory. */
+static size_t
+shrink_arenas (struct shrinker *s UNUSED, size_t page_cnt)
+{
+  size_t freed = 0;
+  size_t i;
+
+  for (i = 0; i < desc_cnt && freed < page_cnt; i++)
+    {
+      struct desc *d = &descs[i];
+      struct list_elem *e;
+
+      if (d->empty_cnt == 0 || lock_held_by_current_thread (&d->lock)
+          || !lock_try_acquire (&d->lock))
+        continue;
+      for (e = list_begin (&d->free_list);
+           e != list_end (&d->free_list) && d->empty_cnt > 0
+             && freed < page_cnt; )
+        {
+          struct arena *a = block_to_arena (list_entry (e, struct block,
+                                                        free_elem));
+          if (a->free_cnt == d->blocks_per_arena)
+            {
+              /* Start over, since E is about to be removed. */
+              free_arena (d, a);
+              freed++;
+              e = list_begin (&d->free_list);
+            }
+          else
+            e = list_next (e);
+        }
+      lock_release (&d->lock);
+    }
+  return freed;
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
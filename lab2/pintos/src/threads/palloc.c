@@ -2,12 +2,15 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/heapprof.h"
 #include "threads/loader.h"
+#include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -21,24 +24,138 @@
    that the kernel needs to have memory for its own operations
    even if user processes are swapping like mad.
 
-   By default, half of system RAM is given to the kernel pool and
-   half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   The pools do not own fixed ranges of memory, though.  All free
+   memory is kept together, and each pool only has a share of it:
+   a number of pages it may have allocated at once.  Half of
+   system RAM starts out as the user pool's share and the rest as
+   the kernel pool's.  When a pool runs out of share, it borrows
+   free share from the other pool, and it also tops up its free
+   share ahead of time whenever that drops below its low
+   watermark, up to its high watermark.  A pool that frees pages
+   beyond its high watermark hands the excess to the other pool,
+   if that one is below its own high watermark.  Pages lent to
+   the user pool never cut into the kernel pool's reserve, its
+   low watermark, so that the kernel can still allocate that
+   many pages even if user processes have taken all the rest.
 
-/* A memory pool. */
+   Free memory is managed as a binary buddy system.  It is kept as
+   blocks of 2**ORDER pages, aligned to their size, on one free
+   list per order.  A request for PAGE_CNT pages takes the
+   smallest free block that is big enough, splitting larger
+   blocks in halves as needed, and gives the pages beyond
+   PAGE_CNT back right away.  Freeing pages merges each block with
+   its "buddy", the other half of the block it was split from,
+   for as long as the buddy is free too.  Both take time
+   logarithmic in the size of memory, instead of the linear scan
+   a first-fit search would need.
+
+   There is also a small stock of pages that are already zeroed,
+   which the idle thread fills by calling palloc_zero_idle() when
+   no other thread wants to run.  A single-page PAL_ZERO request
+   takes one of these if it can and thus costs no memset().  The
+   stock is allocated from the buddy system but belongs to
+   neither pool, so it is given back whenever an allocation would
+   otherwise fail.
+
+   Other kernel caches that hold on to pages they could do
+   without register a "shrinker" with palloc_register_shrinker().
+   When an allocation is about to fail even after the pre-zeroed
+   pages have been given back, the shrinkers are called in order
+   of priority to free up pages, and the allocation is tried
+   again for as long as they free any.  A shrinker may be called
+   by a thread that is in the middle of using the cache, so it
+   must not wait for the cache's locks but skip whatever it
+   cannot lock right away. */
+
+/* Largest block order.  Free memory may span up to 2**MAX_ORDER
+   pages, that is, 4 GB. */
+#define MAX_ORDER 20
+
+/* Marks the first page of a free block in the ORDERS array,
+   where the low bits hold the block's order. */
+#define BLOCK_FREE 0x80
+
+/* Marks each allocated page of the user pool in the ORDERS
+   array. */
+#define PAGE_USER 0x40
+
+/* Default number of pre-zeroed pages kept. */
+#define ZERO_TARGET 32
+
+/* Minimum size of the kernel pool's reserve, in pages. */
+#define RESERVE_MIN 16
+
+/* A free block of pages, stored in its own first page.  Also
+   links pre-zeroed pages together, in which case it is cleared
+   again before the page is handed out. */
+struct free_block
+  {
+    struct list_elem elem;              /* Element in a free list. */
+  };
+
+/* A memory pool: a share of free memory.  Protected by LOCK. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
-    struct bitmap *used_map;            /* Bitmap of free pages. */
-    uint8_t *base;                      /* Base of pool. */
+    const char *name;                   /* Name, for statistics. */
+    size_t size;                        /* Pages in the pool's share. */
+    size_t max_size;                    /* Largest SIZE allowed. */
+    size_t used_cnt;                    /* Pages allocated from it. */
+    size_t low, high;                   /* Watermarks of free share. */
+    size_t borrowed;                    /* Pages taken from the other
+                                           pool. */
+    size_t transfers;                   /* Number of times it took
+                                           pages from the other pool. */
+    size_t zero_hits;                   /* PAL_ZERO requests served
+                                           from pre-zeroed pages. */
+    size_t zero_misses;                 /* Other PAL_ZERO requests. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
-static void init_pool (struct pool *, void *base, size_t page_cnt,
-                       const char *name);
-static bool page_from_pool (const struct pool *, void *page);
+/* Free memory. */
+static struct lock lock;                /* Mutual exclusion. */
+static struct bitmap *used_map;         /* Bitmap of free pages. */
+static uint8_t *orders;                 /* Per page: BLOCK_FREE | order
+                                           if the first page of a free
+                                           block, PAGE_USER if a user
+                                           page, otherwise 0. */
+static struct list free_lists[MAX_ORDER + 1]; /* Free blocks, by order. */
+static size_t free_cnt;                 /* Number of free pages. */
+static uint8_t *base;                   /* First page. */
+
+/* Pre-zeroed pages.  These are allocated as far as the buddy
+   system and used_map are concerned.  Protected by turning
+   interrupts off, not by LOCK, so that the idle thread never has
+   to wait to add a page. */
+static struct list zeroed;
+static size_t zeroed_cnt;
+
+/* Number of pre-zeroed pages to keep. */
+static size_t zero_target = ZERO_TARGET;
+
+/* Registered shrinkers, in order of priority. */
+static struct list shrinkers;
+static struct lock shrinkers_lock;
+
+static size_t get_pages (struct pool *, size_t page_cnt, bool *zero);
+static size_t shrink_caches (size_t page_cnt);
+static bool shrinker_less (const struct list_elem *,
+                           const struct list_elem *, void *);
+static void init_pool (struct pool *, size_t size, size_t max_size,
+                       size_t low, size_t high, const char *name);
+static struct pool *other_pool (struct pool *);
+static size_t free_share (const struct pool *);
+static size_t lendable (struct pool *, bool keep_low);
+static bool borrow (struct pool *, size_t page_cnt, bool keep_low);
+static void give_back (struct pool *);
+static size_t alloc_pages (size_t page_cnt);
+static void free_pages (size_t page_idx, size_t page_cnt);
+static void free_block (size_t page_idx, int order);
+static int order_for (size_t page_cnt);
+static size_t take_zeroed_page (void);
+static bool release_zeroed_pages (void);
+static bool zero_page (void);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -48,17 +165,52 @@ palloc_init (size_t user_page_limit)
   /* Free memory starts at 1 MB and runs to the end of RAM. */
   uint8_t *free_start = ptov (1024 * 1024);
   uint8_t *free_end = ptov (init_ram_pages * PGSIZE);
-  size_t free_pages = (free_end - free_start) / PGSIZE;
-  size_t user_pages = free_pages / 2;
-  size_t kernel_pages;
+  size_t page_cnt = (free_end - free_start) / PGSIZE;
+  size_t user_pages, reserve;
+
+  /* We'll put used_map and the order of each page at the start of
+     free memory.  Calculate the space needed for them and
+     subtract it from the pages to manage. */
+  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt) + page_cnt,
+                                  PGSIZE);
+  int order;
+
+  if (bm_pages > page_cnt)
+    PANIC ("Not enough memory for bitmap.");
+  page_cnt -= bm_pages;
+  if (page_cnt > (size_t) 1 << MAX_ORDER)
+    PANIC ("Too much memory.");
+
+  lock_init (&lock);
+  used_map = bitmap_create_in_buf (page_cnt, free_start, bm_pages * PGSIZE);
+  orders = free_start + bitmap_buf_size (page_cnt);
+  memset (orders, 0, page_cnt);
+  for (order = 0; order <= MAX_ORDER; order++)
+    list_init (&free_lists[order]);
+  free_cnt = 0;
+  base = free_start + bm_pages * PGSIZE;
+  list_init (&zeroed);
+  zeroed_cnt = 0;
+  list_init (&shrinkers);
+  lock_init (&shrinkers_lock);
+
+  /* Put all of the pages on the free lists. */
+  free_pages (0, page_cnt);
+
+  /* Give half of memory to kernel, half to user, and keep a
+     sixteenth of it for the kernel in any case. */
+  user_pages = page_cnt / 2;
   if (user_pages > user_page_limit)
     user_pages = user_page_limit;
-  kernel_pages = free_pages - user_pages;
-
-  /* Give half of memory to kernel, half to user. */
-  init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
-  init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
-             user_pages, "user pool");
+  reserve = page_cnt / 16;
+  if (reserve < RESERVE_MIN)
+    reserve = RESERVE_MIN;
+  if (reserve > page_cnt - user_pages)
+    reserve = page_cnt - user_pages;
+  init_pool (&kernel_pool, page_cnt - user_pages, SIZE_MAX,
+             reserve, reserve * 2, "kernel pool");
+  init_pool (&user_pool, user_pages, user_page_limit,
+             page_cnt / 64, page_cnt / 32, "user pool");
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -73,22 +225,23 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
   size_t page_idx;
+  bool zero = (flags & PAL_ZERO) != 0;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  page_idx = get_pages (pool, page_cnt, &zero);
+  while (page_idx == BITMAP_ERROR && shrink_caches (page_cnt) > 0)
+    page_idx = get_pages (pool, page_cnt, &zero);
 
   if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
+    pages = base + PGSIZE * page_idx;
   else
     pages = NULL;
 
   if (pages != NULL) 
     {
-      if (flags & PAL_ZERO)
+      if (zero)
         memset (pages, 0, PGSIZE * page_cnt);
     }
   else 
@@ -97,6 +250,8 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
         PANIC ("palloc_get: out of pages");
     }
 
+  heapprof_alloc (HEAPPROF_PALLOC, pages, PGSIZE * page_cnt,
+                  HEAPPROF_CALLER);
   return pages;
 }
 
@@ -110,35 +265,45 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 void *
 palloc_get_page (enum palloc_flags flags) 
 {
-  return palloc_get_multiple (flags, 1);
+  void *page = palloc_get_multiple (flags, 1);
+  heapprof_set_caller (page, HEAPPROF_CALLER);
+  return page;
 }
 
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
-  struct pool *pool;
-  size_t page_idx;
+  size_t page_idx, user_cnt, i;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
     return;
 
-  if (page_from_pool (&kernel_pool, pages))
-    pool = &kernel_pool;
-  else if (page_from_pool (&user_pool, pages))
-    pool = &user_pool;
-  else
-    NOT_REACHED ();
-
-  page_idx = pg_no (pages) - pg_no (pool->base);
+  ASSERT ((uint8_t *) pages >= base);
+  page_idx = pg_no (pages) - pg_no (base);
+  ASSERT (page_idx + page_cnt <= bitmap_size (used_map));
+  heapprof_free (pages);
 
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  lock_acquire (&lock);
+  ASSERT (bitmap_all (used_map, page_idx, page_cnt));
+  user_cnt = 0;
+  for (i = page_idx; i < page_idx + page_cnt; i++)
+    if (orders[i] == PAGE_USER)
+      {
+        orders[i] = 0;
+        user_cnt++;
+      }
+  user_pool.used_cnt -= user_cnt;
+  kernel_pool.used_cnt -= page_cnt - user_cnt;
+  bitmap_set_multiple (used_map, page_idx, page_cnt, false);
+  free_pages (page_idx, page_cnt);
+  give_back (user_cnt > 0 ? &user_pool : &kernel_pool);
+  lock_release (&lock);
 }
 
 /* Frees the page at PAGE. */
@@ -148,35 +313,463 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
-/* Initializes pool P as starting at START and ending at END,
+/* Stores the free memory of the user pool into *STATS if PAL_USER
+   is set in FLAGS, otherwise that of the kernel pool.  Pages the
+   pool could borrow from the other pool count as free. */
+void
+palloc_get_stats (enum palloc_flags flags, struct palloc_stats *stats)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  int order;
+
+  lock_acquire (&lock);
+  stats->share_pages = pool->size;
+  stats->free_pages = free_share (pool) + lendable (pool, false);
+  stats->zeroed_pages = zeroed_cnt;
+  stats->zero_hits = pool->zero_hits;
+  stats->zero_misses = pool->zero_misses;
+  stats->borrowed_pages = pool->borrowed;
+  stats->largest_free = 0;
+  for (order = MAX_ORDER; order >= 0; order--)
+    if (!list_empty (&free_lists[order]))
+      {
+        stats->largest_free = (size_t) 1 << order;
+        break;
+      }
+  if (stats->largest_free > stats->free_pages)
+    stats->largest_free = stats->free_pages;
+  lock_release (&lock);
+}
+
+/* Sets the number of pre-zeroed pages to keep to PAGE_CNT and
+   returns the previous number.  Zero turns pre-zeroing off and
+   gives back the pages already zeroed. */
+size_t
+palloc_set_zero_target (size_t page_cnt)
+{
+  size_t old_target = zero_target;
+
+  zero_target = page_cnt;
+  if (page_cnt == 0 && base != NULL)
+    {
+      lock_acquire (&lock);
+      release_zeroed_pages ();
+      lock_release (&lock);
+    }
+  return old_target;
+}
+
+/* Zeroes a free page for later PAL_ZERO requests, if there are
+   fewer pre-zeroed pages than wanted.  Returns true if it zeroed
+   a page, false if there was nothing to do.  Called by the idle
+   thread, so it never waits for a lock. */
+bool
+palloc_zero_idle (void)
+{
+  return zero_page ();
+}
+
+/* Prints statistics about the pools, pre-zeroed pages, and
+   shrinkers. */
+void
+palloc_print_stats (void)
+{
+  const struct pool *pools[] = {&kernel_pool, &user_pool};
+  struct list_elem *e;
+  size_t i;
+
+  for (i = 0; i < sizeof pools / sizeof *pools; i++)
+    {
+      const struct pool *p = pools[i];
+
+      printf ("Palloc: %s %zu pages, %zu in use, %zu borrowed "
+              "in %zu transfers, %zu zeroed-page hits, %zu misses\n",
+              p->name, p->size, p->used_cnt, p->borrowed, p->transfers,
+              p->zero_hits, p->zero_misses);
+    }
+
+  lock_acquire (&shrinkers_lock);
+  for (e = list_begin (&shrinkers); e != list_end (&shrinkers);
+       e = list_next (e))
+    {
+      struct shrinker *s = list_entry (e, struct shrinker, elem);
+
+      printf ("Palloc: shrinker %s freed %zu pages in %zu calls\n",
+              s->name, s->reclaimed, s->calls);
+    }
+  lock_release (&shrinkers_lock);
+}
+
+/* Registers shrinker S, named NAME, which frees pages of a cache
+   by calling SHRINK when memory runs short.  Shrinkers with lower
+   PRIORITY are called first. */
+void
+palloc_register_shrinker (struct shrinker *s, const char *name,
+                          int priority, shrink_func *shrink)
+{
+  s->name = name;
+  s->priority = priority;
+  s->shrink = shrink;
+  s->calls = s->reclaimed = 0;
+
+  lock_acquire (&shrinkers_lock);
+  list_insert_ordered (&shrinkers, &s->elem, shrinker_less, NULL);
+  lock_release (&shrinkers_lock);
+}
+
+/* Unregisters shrinker S. */
+void
+palloc_unregister_shrinker (struct shrinker *s)
+{
+  lock_acquire (&shrinkers_lock);
+  list_remove (&s->elem);
+  lock_release (&shrinkers_lock);
+}
+
+/* Tries to allocate PAGE_CNT contiguous pages from POOL and
+   returns the index of the first one, or BITMAP_ERROR if there
+   are not enough.  If *ZERO is true, the pages are to be zeroed;
+   sets *ZERO to false if they already are. */
+static size_t
+get_pages (struct pool *pool, size_t page_cnt, bool *zero)
+{
+  size_t page_idx = BITMAP_ERROR;
+
+  lock_acquire (&lock);
+  if (free_share (pool) >= page_cnt
+      || borrow (pool, page_cnt - free_share (pool), false))
+    {
+      /* A pre-zeroed page needs no further work. */
+      if (*zero && page_cnt == 1)
+        {
+          page_idx = take_zeroed_page ();
+          if (page_idx != BITMAP_ERROR)
+            {
+              pool->zero_hits++;
+              *zero = false;
+            }
+        }
+      if (page_idx == BITMAP_ERROR)
+        {
+          page_idx = alloc_pages (page_cnt);
+          if (page_idx == BITMAP_ERROR && release_zeroed_pages ())
+            page_idx = alloc_pages (page_cnt);
+          if (page_idx != BITMAP_ERROR)
+            bitmap_set_multiple (used_map, page_idx, page_cnt, true);
+          if (*zero)
+            pool->zero_misses++;
+        }
+      if (page_idx != BITMAP_ERROR)
+        {
+          pool->used_cnt += page_cnt;
+          if (pool == &user_pool)
+            memset (orders + page_idx, PAGE_USER, page_cnt);
+
+          /* Top up the free share ahead of the next request. */
+          if (free_share (pool) < pool->low)
+            borrow (pool, pool->high - free_share (pool), true);
+        }
+    }
+  lock_release (&lock);
+
+  return page_idx;
+}
+
+/* Asks the shrinkers, in order of priority, to free PAGE_CNT
+   pages between them.  Returns the number of pages freed. */
+static size_t
+shrink_caches (size_t page_cnt)
+{
+  size_t freed = 0;
+  struct list_elem *e;
+
+  /* A shrinker that allocates memory gets no help. */
+  if (lock_held_by_current_thread (&shrinkers_lock))
+    return 0;
+
+  lock_acquire (&shrinkers_lock);
+  for (e = list_begin (&shrinkers); e != list_end (&shrinkers)
+         && freed < page_cnt; e = list_next (e))
+    {
+      struct shrinker *s = list_entry (e, struct shrinker, elem);
+      size_t cnt = s->shrink (s, page_cnt - freed);
+
+      s->calls++;
+      s->reclaimed += cnt;
+      freed += cnt;
+    }
+  lock_release (&shrinkers_lock);
+
+  return freed;
+}
+
+/* Orders shrinkers by priority. */
+static bool
+shrinker_less (const struct list_elem *a_, const struct list_elem *b_,
+               void *aux UNUSED)
+{
+  const struct shrinker *a = list_entry (a_, struct shrinker, elem);
+  const struct shrinker *b = list_entry (b_, struct shrinker, elem);
+
+  return a->priority < b->priority;
+}
+
+/* Initializes pool P with a share of SIZE pages, which may grow
+   to MAX_SIZE, and watermarks LOW and HIGH for its free share,
    naming it NAME for debugging purposes. */
 static void
-init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
+init_pool (struct pool *p, size_t size, size_t max_size,
+           size_t low, size_t high, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  printf ("%zu pages available in %s.\n", size, name);
+
+  p->name = name;
+  p->size = size;
+  p->max_size = max_size;
+  p->used_cnt = 0;
+  p->low = low;
+  p->high = high;
+  p->borrowed = p->transfers = 0;
+  p->zero_hits = p->zero_misses = 0;
+}
+
+/* Returns the pool that POOL borrows pages from. */
+static struct pool *
+other_pool (struct pool *pool)
+{
+  return pool == &kernel_pool ? &user_pool : &kernel_pool;
+}
 
-  printf ("%zu pages available in %s.\n", page_cnt, name);
+/* Returns the number of pages POOL may still allocate without
+   borrowing.  LOCK must be held. */
+static size_t
+free_share (const struct pool *pool)
+{
+  return pool->size - pool->used_cnt;
+}
+
+/* Returns the number of pages POOL may borrow from the other
+   pool.  The other pool keeps its low watermark if KEEP_LOW is
+   true, or if it is the kernel pool, whose low watermark is its
+   reserve.  LOCK must be held. */
+static size_t
+lendable (struct pool *pool, bool keep_low)
+{
+  struct pool *donor = other_pool (pool);
+  size_t keep = keep_low || donor == &kernel_pool ? donor->low : 0;
+  size_t page_cnt = free_share (donor);
 
-  /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  page_cnt = page_cnt > keep ? page_cnt - keep : 0;
+  if (page_cnt > pool->max_size - pool->size)
+    page_cnt = pool->max_size - pool->size;
+  return page_cnt;
 }
 
-/* Returns true if PAGE was allocated from POOL,
-   false otherwise. */
+/* Moves up to PAGE_CNT pages of free share from the other pool
+   to POOL, as allowed by lendable() with KEEP_LOW.  Returns true
+   if it moved all PAGE_CNT pages.  LOCK must be held. */
 static bool
-page_from_pool (const struct pool *pool, void *page) 
+borrow (struct pool *pool, size_t page_cnt, bool keep_low)
+{
+  struct pool *donor = other_pool (pool);
+  size_t avail = lendable (pool, keep_low);
+  size_t moved = page_cnt < avail ? page_cnt : avail;
+
+  if (moved > 0)
+    {
+      donor->size -= moved;
+      pool->size += moved;
+      pool->borrowed += moved;
+      pool->transfers++;
+    }
+  return moved == page_cnt;
+}
+
+/* Hands the free share of POOL beyond its high watermark to the
+   other pool, as far as that pool is below its own high
+   watermark.  LOCK must be held. */
+static void
+give_back (struct pool *pool)
+{
+  struct pool *other = other_pool (pool);
+  size_t excess, want;
+
+  if (free_share (pool) <= pool->high || free_share (other) >= other->high)
+    return;
+  excess = free_share (pool) - pool->high;
+  want = other->high - free_share (other);
+  if (want > other->max_size - other->size)
+    want = other->max_size - other->size;
+  borrow (other, excess < want ? excess : want, true);
+}
+/* Returns the smallest order whose blocks hold PAGE_CNT pages. */
+static int
+order_for (size_t page_cnt)
+{
+  int order = 0;
+
+  while (((size_t) 1 << order) < page_cnt)
+    order++;
+  return order;
+}
+
+/* Takes PAGE_CNT contiguous pages off the free lists and returns
+   the index of the first one, or BITMAP_ERROR if there is no free
+   block big enough.  LOCK must be held. */
+static size_t
+alloc_pages (size_t page_cnt)
 {
-  size_t page_no = pg_no (page);
-  size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  int want = order_for (page_cnt);
+  struct free_block *b;
+  size_t page_idx;
+  int order;
+
+  if (want > MAX_ORDER)
+    return BITMAP_ERROR;
+
+  /* Find the smallest free block that is big enough. */
+  for (order = want; order <= MAX_ORDER; order++)
+    if (!list_empty (&free_lists[order]))
+      break;
+  if (order > MAX_ORDER)
+    return BITMAP_ERROR;
+
+  b = list_entry (list_pop_front (&free_lists[order]),
+                  struct free_block, elem);
+  page_idx = pg_no (b) - pg_no (base);
+  orders[page_idx] = 0;
+  free_cnt -= (size_t) 1 << order;
+
+  /* Split it down to the order we want, freeing the upper halves,
+     then give back the pages of the block beyond PAGE_CNT. */
+  while (order > want)
+    {
+      order--;
+      free_block (page_idx + ((size_t) 1 << order), order);
+    }
+  free_pages (page_idx + page_cnt, ((size_t) 1 << want) - page_cnt);
+
+  return page_idx;
+}
+
+/* Puts the PAGE_CNT pages starting at PAGE_IDX on the free lists,
+   as the largest aligned blocks that cover them.  LOCK must be
+   held, unless the allocator is being initialized. */
+static void
+free_pages (size_t page_idx, size_t page_cnt)
+{
+  while (page_cnt > 0)
+    {
+      int order = 0;
+
+      while (order < MAX_ORDER
+             && (page_idx & ((size_t) 1 << order)) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      free_block (page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Frees the block of 2**ORDER pages starting at PAGE_IDX, merging
+   it with its buddy for as long as the buddy is free.  LOCK must
+   be held, unless the allocator is being initialized. */
+static void
+free_block (size_t page_idx, int order)
+{
+  size_t page_cnt = bitmap_size (used_map);
+  struct free_block *b;
+
+  free_cnt += (size_t) 1 << order;
+  while (order < MAX_ORDER)
+    {
+      size_t buddy = page_idx ^ ((size_t) 1 << order);
+
+      if (buddy + ((size_t) 1 << order) > page_cnt
+          || orders[buddy] != (BLOCK_FREE | order))
+        break;
+
+      b = (struct free_block *) (base + PGSIZE * buddy);
+      list_remove (&b->elem);
+      orders[buddy] = 0;
+      page_idx &= ~((size_t) 1 << order);
+      order++;
+    }
+
+  b = (struct free_block *) (base + PGSIZE * page_idx);
+  list_push_front (&free_lists[order], &b->elem);
+  orders[page_idx] = BLOCK_FREE | order;
+}
+
+/* Takes a pre-zeroed page and returns its index, or returns
+   BITMAP_ERROR if there is none. */
+static size_t
+take_zeroed_page (void)
+{
+  struct free_block *page = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (!list_empty (&zeroed))
+    {
+      page = list_entry (list_pop_front (&zeroed), struct free_block, elem);
+      zeroed_cnt--;
+    }
+  intr_set_level (old_level);
+
+  if (page == NULL)
+    return BITMAP_ERROR;
+  memset (page, 0, sizeof *page);
+  return pg_no (page) - pg_no (base);
+}
+
+/* Gives all of the pre-zeroed pages back to the free lists.
+   Returns true if there were any.  LOCK must be held. */
+static bool
+release_zeroed_pages (void)
+{
+  bool released = false;
+
+  ASSERT (lock_held_by_current_thread (&lock));
+
+  for (;;)
+    {
+      size_t page_idx = take_zeroed_page ();
+
+      if (page_idx == BITMAP_ERROR)
+        return released;
+      bitmap_reset (used_map, page_idx);
+      free_pages (page_idx, 1);
+      released = true;
+    }
+}
+
+/* Zeroes one free page and adds it to the pre-zeroed pages, if
+   there are fewer than there should be.  Returns true if it
+   zeroed a page.  Does nothing if LOCK is busy. */
+static bool
+zero_page (void)
+{
+  enum intr_level old_level;
+  struct free_block *page;
+  size_t page_idx;
+
+  if (zeroed_cnt >= zero_target || !lock_try_acquire (&lock))
+    return false;
+  page_idx = alloc_pages (1);
+  if (page_idx != BITMAP_ERROR)
+    bitmap_mark (used_map, page_idx);
+  lock_release (&lock);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  page = (struct free_block *) (base + PGSIZE * page_idx);
+  memset (page, 0, PGSIZE);
 
-  return page_no >= start_page && page_no < end_page;
+  old_level = intr_disable ();
+  list_push_front (&zeroed, &page->elem);
+  zeroed_cnt++;
+  intr_set_level (old_level);
+  return true;
 }
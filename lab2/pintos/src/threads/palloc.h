@@ -1,6 +1,8 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <list.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -11,10 +13,48 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+/* Free memory in a pool, in pages, and use of its pre-zeroed
+   pages. */
+struct palloc_stats
+  {
+    size_t share_pages;         /* Pages in the pool's share now. */
+    size_t borrowed_pages;      /* Pages taken from the other pool. */
+    size_t free_pages;          /* Number of pages it could allocate. */
+    size_t largest_free;        /* Largest contiguous allocation. */
+    size_t zeroed_pages;        /* Free pages that are pre-zeroed. */
+    size_t zero_hits;           /* PAL_ZERO requests that found one. */
+    size_t zero_misses;         /* PAL_ZERO requests that did not. */
+  };
+
+/* A cache that can give pages back to the page allocator when
+   memory runs short.  See palloc.c for details. */
+struct shrinker;
+
+/* Frees up to PAGE_CNT pages held by shrinker S's cache, and
+   returns the number of pages freed. */
+typedef size_t shrink_func (struct shrinker *s, size_t page_cnt);
+
+struct shrinker
+  {
+    const char *name;           /* Name, for statistics. */
+    int priority;               /* Lower priorities are called first. */
+    shrink_func *shrink;        /* Callback. */
+    size_t calls;               /* Number of calls. */
+    size_t reclaimed;           /* Pages freed by all calls. */
+    struct list_elem elem;      /* Element in list of shrinkers. */
+  };
+
 void palloc_init (size_t user_page_limit);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+void palloc_get_stats (enum palloc_flags, struct palloc_stats *);
+size_t palloc_set_zero_target (size_t page_cnt);
+bool palloc_zero_idle (void);
+void palloc_print_stats (void);
+void palloc_register_shrinker (struct shrinker *, const char *name,
+                               int priority, shrink_func *);
+void palloc_unregister_shrinker (struct shrinker *);
 
 #endif /* threads/palloc.h */
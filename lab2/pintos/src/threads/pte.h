@@ -66,6 +66,7 @@ static inline uintptr_t pd_no (const void *va) {
 #define PTE_U 0x4               /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20              /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40              /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80             /* 1=4 MB page, 0=page table (PDEs only). */
 
 /* Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create (uint32_t *pt) {
@@ -73,10 +74,23 @@ static inline uint32_t pde_create (uint32_t *pt) {
   return vtop (pt) | PTE_U | PTE_P | PTE_W;
 }
 
+/* Returns a PDE that maps PAGE, which must be aligned on a
+   PTSPAN (4 MB) boundary, directly as one large page, without a
+   page table.  The page is readable, and writable as well if
+   WRITABLE is true, and usable only by the kernel.  The CPU must
+   have PSE enabled.  See [IA32-v3a] 3.7.3 "Mixing 4-KByte and
+   4-MByte Pages". */
+static inline uint32_t pde_create_large (void *page, bool writable) {
+  ASSERT (((uintptr_t) page & (PTSPAN - 1)) == 0);
+  return vtop (page) | PTE_PS | PTE_P | (writable ? PTE_W : 0);
+}
+
 /* Returns a pointer to the page table that page directory entry
-   PDE, which must "present", points to. */
+   PDE, which must "present" and not map a large page, points
+   to. */
 static inline uint32_t *pde_get_pt (uint32_t pde) {
   ASSERT (pde & PTE_P);
+  ASSERT (!(pde & PTE_PS));
   return ptov (pde & PTE_ADDR);
 }
 
@@ -103,5 +117,18 @@ static inline void *pte_get_page (uint32_t pte) {
   return ptov (pte & PTE_ADDR);
 }
 
+/* Invalidates the TLB entry, if any, for virtual address VADDR
+   in the active page directory, after a change to its page table
+   entry.  Unlike reloading CR3, this leaves the TLB entries for
+   every other page alone.  See [IA32-v2a] "INVLPG--Invalidate
+   TLB Entry". */
+static inline void tlb_invalidate_page (const void *vaddr) {
+  asm volatile ("invlpg (%0)" : : "r" (vaddr) : "memory");
+}
+
+/* Invalidating more than this many pages one at a time costs
+   more than reloading CR3 and refilling the TLB afterward. */
+#define TLB_INVALIDATE_MAX 32
+
 #endif /* threads/pte.h */
 
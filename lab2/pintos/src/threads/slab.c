@@ -0,0 +1,320 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Slab caches for kernel objects that are allocated and freed
+   all the time.
+
+   A cache hands out objects of a single size.  It gets its memory
+   a page at a time from the page allocator; each such page is a
+   "slab" that holds a header, a stack of the indexes of its free
+   objects, and the objects themselves, packed at their own size
+   rounded up to a word instead of malloc()'s power of 2.
+
+   Each slab is on one of three lists of its cache: partial slabs
+   are used first, then an empty slab, and only then is a new page
+   allocated.  A cache keeps up to SLAB_EMPTY_MAX empty slabs
+   around, giving any others back to the page allocator, which
+   can also take the kept ones back through a shrinker when it
+   runs short of memory.
+
+   A cache may have a constructor, which is run on each object
+   once, when its slab is created.  Because free objects are
+   tracked outside of the objects, an object keeps its contents
+   while it is free, so slab_free() must be given objects back in
+   their constructed state.  Hot objects then come out of
+   slab_alloc() ready to use. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Most empty slabs a cache keeps. */
+#define SLAB_EMPTY_MAX 4
+
+/* Slab header, at the start of each slab's page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct slab_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in one of the cache's lists. */
+    size_t free_cnt;            /* Number of free objects. */
+    uint16_t free_idx[];        /* Indexes of free objects, as a stack. */
+  };
+
+/* All slab caches. */
+static struct list all_caches;
+static struct lock all_caches_lock;
+
+/* Gives empty slabs back under memory pressure. */
+static struct shrinker slab_shrinker;
+
+static struct slab *new_slab (struct slab_cache *);
+static size_t shrink_slabs (struct shrinker *, size_t page_cnt);
+static struct slab *obj_to_slab (struct slab_cache *, void *);
+
+/* Initializes the slab allocator. */
+void
+slab_init (void)
+{
+  list_init (&all_caches);
+  lock_init (&all_caches_lock);
+  palloc_register_shrinker (&slab_shrinker, "slab", 0, shrink_slabs);
+}
+
+/* Initializes C as a cache of OBJ_SIZE-byte objects named NAME.
+   If CTOR is non-null, it is called with each new object and AUX
+   before the object is first handed out. */
+void
+slab_cache_init (struct slab_cache *c, const char *name, size_t obj_size,
+                 slab_ctor_func *ctor, void *aux)
+{
+  size_t n;
+
+  ASSERT (c != NULL);
+  ASSERT (obj_size > 0);
+
+  c->name = name;
+  c->obj_size = ROUND_UP (obj_size, sizeof (void *));
+  c->ctor = ctor;
+  c->aux = aux;
+
+  /* Fit as many objects into a page as the header and the free
+     stack leave room for. */
+  n = (PGSIZE - sizeof (struct slab)) / (c->obj_size + sizeof (uint16_t));
+  while (n > 0
+         && (ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+                       sizeof (void *))
+             + n * c->obj_size) > PGSIZE)
+    n--;
+  if (n == 0)
+    PANIC ("slab cache %s: %zu-byte objects do not fit in a page",
+           name, obj_size);
+  c->objs_per_slab = n;
+  c->obj_ofs = ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+                         sizeof (void *));
+
+  lock_init (&c->lock);
+  list_init (&c->partial);
+  list_init (&c->full);
+  list_init (&c->empty);
+  c->empty_cnt = 0;
+  c->slab_cnt = 0;
+  c->in_use = 0;
+
+  lock_acquire (&all_caches_lock);
+  list_push_back (&all_caches, &c->elem);
+  lock_release (&all_caches_lock);
+}
+
+/* Frees all of C's slabs.  None of C's objects may be in use. */
+void
+slab_cache_destroy (struct slab_cache *c)
+{
+  ASSERT (c->in_use == 0);
+
+  lock_acquire (&all_caches_lock);
+  list_remove (&c->elem);
+  lock_release (&all_caches_lock);
+
+  while (!list_empty (&c->empty))
+    {
+      struct slab *s = list_entry (list_pop_front (&c->empty),
+                                   struct slab, elem);
+      palloc_free_page (s);
+    }
+  c->empty_cnt = 0;
+  c->slab_cnt = 0;
+}
+
+/* Obtains and returns an object from C.  Returns a null pointer
+   if memory is not available. */
+void *
+slab_alloc (struct slab_cache *c)
+{
+  struct slab *s;
+  size_t idx;
+
+  lock_acquire (&c->lock);
+  if (!list_empty (&c->partial))
+    s = list_entry (list_front (&c->partial), struct slab, elem);
+  else if (!list_empty (&c->empty))
+    {
+      s = list_entry (list_pop_front (&c->empty), struct slab, elem);
+      list_push_front (&c->partial, &s->elem);
+      c->empty_cnt--;
+    }
+  else
+    {
+      s = new_slab (c);
+      if (s == NULL)
+        {
+          lock_release (&c->lock);
+          return NULL;
+        }
+      list_push_front (&c->partial, &s->elem);
+    }
+
+  idx = s->free_idx[--s->free_cnt];
+  if (s->free_cnt == 0)
+    {
+      list_remove (&s->elem);
+      list_push_front (&c->full, &s->elem);
+    }
+  c->in_use++;
+  lock_release (&c->lock);
+
+  return (uint8_t *) s + c->obj_ofs + idx * c->obj_size;
+}
+
+/* Returns OBJ, which must have been obtained from C with
+   slab_alloc(), to C.  If C has a constructor, OBJ must be in its
+   constructed state. */
+void
+slab_free (struct slab_cache *c, void *obj)
+{
+  struct slab *s;
+
+  if (obj == NULL)
+    return;
+
+  s = obj_to_slab (c, obj);
+  lock_acquire (&c->lock);
+  if (s->free_cnt == 0)
+    {
+      list_remove (&s->elem);
+      list_push_front (&c->partial, &s->elem);
+    }
+  s->free_idx[s->free_cnt++] = ((uint8_t *) obj - ((uint8_t *) s + c->obj_ofs))
+                               / c->obj_size;
+  c->in_use--;
+
+  /* Keep a few empty slabs for later allocations, give any
+     others back to the page allocator. */
+  if (s->free_cnt == c->objs_per_slab)
+    {
+      list_remove (&s->elem);
+      if (c->empty_cnt < SLAB_EMPTY_MAX)
+        {
+          list_push_front (&c->empty, &s->elem);
+          c->empty_cnt++;
+        }
+      else
+        {
+          c->slab_cnt--;
+          palloc_free_page (s);
+        }
+    }
+  lock_release (&c->lock);
+}
+
+/* Prints, for each cache, how full its slabs are and how much
+   memory its objects take compared to malloc(). */
+void
+slab_print_stats (void)
+{
+  struct list_elem *e;
+
+  lock_acquire (&all_caches_lock);
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e))
+    {
+      struct slab_cache *c = list_entry (e, struct slab_cache, elem);
+      size_t capacity, malloc_bytes, slab_bytes;
+
+      lock_acquire (&c->lock);
+      capacity = c->slab_cnt * c->objs_per_slab;
+      slab_bytes = c->in_use * c->obj_size;
+      malloc_bytes = c->in_use * malloc_round_size (c->obj_size);
+      printf ("Slab %s: %zu-byte objects, %zu of %zu in use (%zu%%) "
+              "in %zu slabs, %zu bytes vs. %zu with malloc\n",
+              c->name, c->obj_size, c->in_use, capacity,
+              capacity > 0 ? c->in_use * 100 / capacity : 0,
+              c->slab_cnt, slab_bytes, malloc_bytes);
+      lock_release (&c->lock);
+    }
+  lock_release (&all_caches_lock);
+}
+
+/* Frees up to PAGE_CNT empty slabs of any cache whose lock is
+   free, and returns the number freed.  Called by the page
+   allocator when it runs short of memory. */
+static size_t
+shrink_slabs (struct shrinker *s UNUSED, size_t page_cnt)
+{
+  struct list_elem *e;
+  size_t freed = 0;
+
+  if (lock_held_by_current_thread (&all_caches_lock)
+      || !lock_try_acquire (&all_caches_lock))
+    return 0;
+  for (e = list_begin (&all_caches);
+       e != list_end (&all_caches) && freed < page_cnt; e = list_next (e))
+    {
+      struct slab_cache *c = list_entry (e, struct slab_cache, elem);
+
+      if (lock_held_by_current_thread (&c->lock)
+          || !lock_try_acquire (&c->lock))
+        continue;
+      while (!list_empty (&c->empty) && freed < page_cnt)
+        {
+          struct slab *slab = list_entry (list_pop_front (&c->empty),
+                                          struct slab, elem);
+          c->empty_cnt--;
+          c->slab_cnt--;
+          palloc_free_page (slab);
+          freed++;
+        }
+      lock_release (&c->lock);
+    }
+  lock_release (&all_caches_lock);
+  return freed;
+}
+
+/* Allocates a page for a new slab of C, runs C's constructor on
+   its objects and returns it, or a null pointer if memory is not
+   available.  C's lock must be held. */
+static struct slab *
+new_slab (struct slab_cache *c)
+{
+  struct slab *s = palloc_get_page (0);
+  size_t i;
+
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->free_cnt = c->objs_per_slab;
+  for (i = 0; i < c->objs_per_slab; i++)
+    {
+      /* Hand out objects from the start of the page first. */
+      s->free_idx[i] = c->objs_per_slab - 1 - i;
+      if (c->ctor != NULL)
+        c->ctor ((uint8_t *) s + c->obj_ofs + i * c->obj_size, c->aux);
+    }
+  c->slab_cnt++;
+  return s;
+}
+
+/* Returns the slab that OBJ, an object of C, is in. */
+static struct slab *
+obj_to_slab (struct slab_cache *c, void *obj)
+{
+  struct slab *s = pg_round_down (obj);
+
+  /* Check that the slab is valid. */
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+
+  /* Check that the object is properly aligned for the slab. */
+  ASSERT (pg_ofs (obj) >= c->obj_ofs);
+  ASSERT ((pg_ofs (obj) - c->obj_ofs) % c->obj_size == 0);
+
+  return s;
+}
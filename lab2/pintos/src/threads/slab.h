@@ -0,0 +1,39 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* Prepares OBJ, a new object of a slab cache, for its first use.
+   AUX is the cache's auxiliary data. */
+typedef void slab_ctor_func (void *obj, void *aux);
+
+/* A cache of objects of a single size.  See slab.c for details. */
+struct slab_cache
+  {
+    const char *name;           /* Name, for statistics. */
+    size_t obj_size;            /* Size of each object in bytes. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    size_t obj_ofs;             /* Offset of first object in a slab. */
+    slab_ctor_func *ctor;       /* Constructor, or null. */
+    void *aux;                  /* Auxiliary data for CTOR. */
+    struct lock lock;           /* Protects the members below. */
+    struct list partial;        /* Slabs with free and used objects. */
+    struct list full;           /* Slabs with no free objects. */
+    struct list empty;          /* Slabs with no used objects. */
+    size_t empty_cnt;           /* Number of slabs in EMPTY. */
+    size_t slab_cnt;            /* Number of slabs. */
+    size_t in_use;              /* Number of allocated objects. */
+    struct list_elem elem;      /* Element in list of all caches. */
+  };
+
+void slab_init (void);
+void slab_cache_init (struct slab_cache *, const char *name, size_t obj_size,
+                      slab_ctor_func *, void *aux);
+void slab_cache_destroy (struct slab_cache *);
+void *slab_alloc (struct slab_cache *);
+void slab_free (struct slab_cache *, void *);
+void slab_print_stats (void);
+
+#endif /* threads/slab.h */
@@ -34,6 +34,17 @@ static struct thread *idle_thread;
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
+/* Threads that have died but whose pages have not been freed
+   yet.  thread_schedule_tail() runs with interrupts off in the
+   middle of a thread switch, where it must not wait for the page
+   allocator's lock, so it only puts the dead thread here.
+   free_dead_threads() frees them later, from a thread that may
+   sleep.  Accessed only with interrupts off. */
+static struct list dead_list;
+
+/* Frees the pages of dead threads when memory runs short. */
+static struct shrinker dead_shrinker;
+
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
@@ -70,6 +81,8 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static size_t free_dead_threads (void);
+static size_t shrink_dead_threads (struct shrinker *, size_t page_cnt);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -92,6 +105,7 @@ thread_init (void)
   lock_init (&tid_lock);
   list_init (&ready_list);
   list_init (&all_list);
+  list_init (&dead_list);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -111,6 +125,8 @@ thread_start (void)
   struct semaphore idle_started;
   sema_init (&idle_started, 0);
   thread_create ("idle", PRI_MIN, idle, &idle_started);
+  palloc_register_shrinker (&dead_shrinker, "dead threads", -1,
+                            shrink_dead_threads);
 
   /* Start preemptive thread scheduling. */
   intr_enable ();
@@ -178,7 +194,9 @@ thread_create (const char *name, int priority,
 
   ASSERT (function != NULL);
 
-  /* Allocate thread. */
+  /* Allocate thread, reusing the page of a dead one if there is
+     any. */
+  free_dead_threads ();
   t = palloc_get_page (PAL_ZERO);
   if (t == NULL)
     return TID_ERROR;
@@ -296,6 +314,7 @@ thread_exit (void)
 #ifdef USERPROG
   process_exit ();
 #endif
+  free_dead_threads ();
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
@@ -411,6 +430,16 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Nobody else wants to run, so zero free pages for later
+         PAL_ZERO requests, a page at a time, until there are
+         enough or another thread becomes ready. */
+      intr_enable ();
+      while (list_empty (&ready_list) && palloc_zero_idle ())
+        continue;
+      intr_disable ();
+      if (!list_empty (&ready_list))
+        continue;
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -538,15 +567,15 @@ thread_schedule_tail (struct thread *prev)
   process_activate ();
 #endif
 
-  /* If the thread we switched from is dying, destroy its struct
-     thread.  This must happen late so that thread_exit() doesn't
-     pull out the rug under itself.  (We don't free
-     initial_thread because its memory was not obtained via
-     palloc().) */
+  /* If the thread we switched from is dying, queue its struct
+     thread to be destroyed.  This must happen late so that
+     thread_exit() doesn't pull out the rug under itself.  (We
+     don't free initial_thread because its memory was not
+     obtained via palloc().) */
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread) 
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      list_push_back (&dead_list, &prev->elem);
     }
 }
 
@@ -573,6 +602,38 @@ schedule (void)
   thread_schedule_tail (prev);
 }
 
+/* Frees the pages of the threads on the dead list.  Returns the
+   number of pages freed. */
+static size_t
+free_dead_threads (void)
+{
+  size_t cnt = 0;
+
+  for (;;)
+    {
+      enum intr_level old_level = intr_disable ();
+      struct thread *t = NULL;
+
+      if (!list_empty (&dead_list))
+        t = list_entry (list_pop_front (&dead_list), struct thread, elem);
+      intr_set_level (old_level);
+
+      if (t == NULL)
+        return cnt;
+      ASSERT (is_thread (t) && t->status == THREAD_DYING);
+      palloc_free_page (t);
+      cnt++;
+    }
+}
+
+/* Shrinker for the dead list.  Frees every dead thread, however
+   many pages were asked for. */
+static size_t
+shrink_dead_threads (struct shrinker *s UNUSED, size_t page_cnt UNUSED)
+{
+  return free_dead_threads ();
+}
+
 /* Returns a tid to use for a new thread. */
 static tid_t
 allocate_tid (void) 
@@ -5,6 +5,10 @@
 #include <list.h>
 #include <stdint.h>
 #include "synch.h"
+#ifdef VM
+#include <hash.h>
+#include "vm/wset.h"
+#endif
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -101,6 +105,28 @@ struct thread
     uint32_t *pagedir;                  /* Page directory. */
 #endif
 
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash pages;                  /* Supplemental page table. */
+    struct lock pages_lock;             /* Guards pages and their frames. */
+    void *fault_next;                   /* Next fault if sequential. */
+    size_t fault_window;                /* Pages to map around a fault. */
+
+    /* Owned by vm/wset.c. */
+    struct list_elem wset_elem;         /* Element in list of processes. */
+    size_t wset[WSET_WINDOW_CNT];       /* Working sets, latest sample. */
+    size_t wset_peak[WSET_WINDOW_CNT];  /* Largest working sets. */
+
+    /* Owned by vm/mmap.c. */
+    struct list mappings;               /* Memory-mapped files. */
+
+    /* Owned by userprog/process.c. */
+    struct file *exec_file;             /* Executable, paged in from. */
+
+    /* Owned by userprog/syscall.c. */
+    void *user_esp;                     /* User stack pointer in syscall. */
+#endif
+
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
   };
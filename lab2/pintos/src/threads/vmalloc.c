@@ -0,0 +1,194 @@
+#include "threads/vmalloc.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdint.h>
+#include "threads/init.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Virtually contiguous kernel memory.
+
+   The page allocator can only hand out runs of pages that are
+   contiguous in physical memory, and hence in the kernel's
+   direct mapping of it.  Once the kernel pool is fragmented, a
+   large request can fail even though enough pages are free.
+
+   vmalloc_pages() instead takes single pages from the kernel
+   pool, wherever they are, and maps them one after another into
+   a region of kernel virtual memory set aside for this above
+   the direct mapping.  Each area is followed by an unmapped
+   guard page, so running off its end faults instead of
+   corrupting the next area.
+
+   The page tables for the whole region are created up front, by
+   vmalloc_init(), and the page directory entries that point to
+   them are copied into each process's page directory along with
+   the rest of the kernel mappings.  Mapping and unmapping pages
+   in the region thus only ever changes these shared page tables
+   and affects every page directory at once. */
+
+/* Start of the region, well above the direct mapping of the at
+   most 64 MB of RAM that start.S lets the kernel use. */
+#define VMALLOC_START ((uint8_t *) PHYS_BASE + 0x30000000)
+
+/* Size of the region in pages: two page tables' worth, 8 MB. */
+#define VMALLOC_PAGES (2 * (PTSPAN / PGSIZE))
+
+/* Pages in the region used by areas or their guard pages. */
+static struct bitmap *used_map;
+static struct lock vmalloc_lock;
+
+static void unmap_pages (uint8_t *area, size_t page_cnt);
+static void release_area (uint8_t *area, size_t page_cnt);
+static uint32_t *lookup_pte (const void *vaddr);
+static void flush_tlb (void);
+
+/* Creates the page tables for the vmalloc region in the initial
+   page directory.  Must be called after paging is set up and
+   before any process's page directory is created. */
+void
+vmalloc_init (void)
+{
+  uint8_t *vaddr;
+  void *buf;
+
+  ASSERT (init_page_dir != NULL);
+
+  for (vaddr = VMALLOC_START; vaddr < VMALLOC_START + VMALLOC_PAGES * PGSIZE;
+       vaddr += PTSPAN)
+    {
+      uint32_t *pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+      ASSERT (init_page_dir[pd_no (vaddr)] == 0);
+      init_page_dir[pd_no (vaddr)] = pde_create (pt);
+    }
+
+  buf = palloc_get_page (PAL_ASSERT);
+  ASSERT (bitmap_buf_size (VMALLOC_PAGES) <= PGSIZE);
+  used_map = bitmap_create_in_buf (VMALLOC_PAGES, buf, PGSIZE);
+  lock_init (&vmalloc_lock);
+}
+
+/* Obtains PAGE_CNT pages from the kernel pool, maps them at
+   contiguous kernel virtual addresses, and returns the first
+   of those addresses.  The pages need not be contiguous in
+   physical memory, so the result must not be passed to vtop().
+   Returns a null pointer if memory or address space is not
+   available, or if vmalloc_init() has not been called yet. */
+void *
+vmalloc_pages (size_t page_cnt)
+{
+  uint8_t *area;
+  size_t page_idx, i;
+
+  if (used_map == NULL || page_cnt == 0)
+    return NULL;
+
+  /* Reserve PAGE_CNT pages of address space plus a guard page. */
+  lock_acquire (&vmalloc_lock);
+  page_idx = bitmap_scan_and_flip (used_map, 0, page_cnt + 1, false);
+  lock_release (&vmalloc_lock);
+  if (page_idx == BITMAP_ERROR)
+    return NULL;
+  area = VMALLOC_START + page_idx * PGSIZE;
+
+  /* Back the area with pages from the kernel pool. */
+  for (i = 0; i < page_cnt; i++)
+    {
+      void *page = palloc_get_page (0);
+      if (page == NULL)
+        {
+          unmap_pages (area, i);
+          release_area (area, page_cnt);
+          return NULL;
+        }
+      *lookup_pte (area + i * PGSIZE) = pte_create_kernel (page, true);
+    }
+  return area;
+}
+
+/* Unmaps the PAGE_CNT pages at AREA, which must have been
+   obtained with vmalloc_pages(), and frees them. */
+void
+vfree_pages (void *area_, size_t page_cnt)
+{
+  uint8_t *area = area_;
+
+  if (area == NULL)
+    return;
+
+  ASSERT (is_vmalloc_vaddr (area));
+  ASSERT (pg_ofs (area) == 0);
+
+  unmap_pages (area, page_cnt);
+  release_area (area, page_cnt);
+}
+
+/* Returns true if VADDR is in the vmalloc region. */
+bool
+is_vmalloc_vaddr (const void *vaddr)
+{
+  return ((const uint8_t *) vaddr >= VMALLOC_START
+          && (const uint8_t *) vaddr < VMALLOC_START + VMALLOC_PAGES * PGSIZE);
+}
+
+/* Unmaps the first PAGE_CNT pages of AREA and frees them.  The
+   pages are freed only once no TLB entry can still reach them. */
+static void
+unmap_pages (uint8_t *area, size_t page_cnt)
+{
+  size_t i;
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      uint32_t *pte = lookup_pte (area + i * PGSIZE);
+
+      ASSERT (*pte & PTE_P);
+      *pte &= ~PTE_P;
+      if (page_cnt <= TLB_INVALIDATE_MAX)
+        tlb_invalidate_page (area + i * PGSIZE);
+    }
+  if (page_cnt > TLB_INVALIDATE_MAX)
+    flush_tlb ();
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      uint32_t *pte = lookup_pte (area + i * PGSIZE);
+
+      palloc_free_page (pte_get_page (*pte));
+      *pte = 0;
+    }
+}
+
+/* Gives back the address space of AREA, PAGE_CNT pages plus its
+   guard page. */
+static void
+release_area (uint8_t *area, size_t page_cnt)
+{
+  size_t page_idx = pg_no (area) - pg_no (VMALLOC_START);
+
+  lock_acquire (&vmalloc_lock);
+  ASSERT (bitmap_all (used_map, page_idx, page_cnt + 1));
+  bitmap_set_multiple (used_map, page_idx, page_cnt + 1, false);
+  lock_release (&vmalloc_lock);
+}
+
+/* Returns the address of the page table entry for VADDR in the
+   vmalloc region. */
+static uint32_t *
+lookup_pte (const void *vaddr)
+{
+  ASSERT (is_vmalloc_vaddr (vaddr));
+  return pde_get_pt (init_page_dir[pd_no (vaddr)]) + pt_no (vaddr);
+}
+
+/* Flushes the TLB by reloading the active page directory, so
+   that unmapped pages in the region are no longer accessible. */
+static void
+flush_tlb (void)
+{
+  uintptr_t pd;
+
+  asm volatile ("movl %%cr3, %0; movl %0, %%cr3" : "=r" (pd) : : "memory");
+}
@@ -0,0 +1,12 @@
+#ifndef THREADS_VMALLOC_H
+#define THREADS_VMALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+void vmalloc_init (void);
+void *vmalloc_pages (size_t page_cnt);
+void vfree_pages (void *, size_t page_cnt);
+bool is_vmalloc_vaddr (const void *);
+
+#endif /* threads/vmalloc.h */
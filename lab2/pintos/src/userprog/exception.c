@@ -4,6 +4,9 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -148,9 +151,19 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  /* To implement virtual memory, delete the rest of the function
-     body, and replace it with code that brings in the page to
-     which fault_addr refers. */
+#ifdef VM
+  /* Bring in the page that FAULT_ADDR refers to, if the process
+     has one that is not in memory yet, or grow its stack, or give
+     a shared page being written a copy of its own.  A fault in
+     the kernel, while it accesses user memory for a system call,
+     has the user stack pointer saved at entry. */
+  if ((not_present || write)
+      && page_fault_in (fault_addr,
+                        user ? f->esp : thread_current ()->user_esp,
+                        write))
+    return;
+#endif
+
   printf ("Page fault at %p: %s error %s page in %s context.\n",
           fault_addr,
           not_present ? "not present" : "rights violation",
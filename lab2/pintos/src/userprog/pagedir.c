@@ -8,6 +8,7 @@
 
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *vaddr);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -16,9 +17,15 @@ static void invalidate_pagedir (uint32_t *);
 uint32_t *
 pagedir_create (void) 
 {
-  uint32_t *pd = palloc_get_page (0);
+  uint32_t *pd = palloc_get_page (PAL_ZERO);
   if (pd != NULL)
-    memcpy (pd, init_page_dir, PGSIZE);
+    {
+      /* Only the kernel's entries need copying.  The user part
+         comes zeroed, often from palloc's pre-zeroed pages. */
+      size_t kernel_pde = pd_no (PHYS_BASE);
+      memcpy (pd + kernel_pde, init_page_dir + kernel_pde,
+              (PGSIZE / sizeof *pd - kernel_pde) * sizeof *pd);
+    }
   return pd;
 }
 
@@ -152,7 +159,7 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
@@ -180,7 +187,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -209,11 +216,61 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
 
+/* Starts batch B of changes to page directory PD.  Pages
+   cleared through B stay in the TLB until pagedir_batch_flush(),
+   which invalidates them all at once, so they must not be
+   touched until then. */
+void
+pagedir_batch_init (struct pagedir_batch *b, uint32_t *pd)
+{
+  b->pd = pd;
+  b->page_cnt = 0;
+}
+
+/* Marks user virtual page UPAGE "not present" in B's page
+   directory, like pagedir_clear_page(), but leaves invalidating
+   its TLB entry to pagedir_batch_flush(). */
+void
+pagedir_batch_clear_page (struct pagedir_batch *b, void *upage)
+{
+  uint32_t *pte;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  pte = lookup_page (b->pd, upage, false);
+  if (pte != NULL && (*pte & PTE_P) != 0)
+    {
+      *pte &= ~PTE_P;
+      if (b->page_cnt < PAGEDIR_BATCH_MAX)
+        b->pages[b->page_cnt] = upage;
+      b->page_cnt++;
+    }
+}
+
+/* Invalidates the TLB entries of every page changed through B,
+   one page at a time if there are few of them or by flushing the
+   whole TLB if there are many, and empties B. */
+void
+pagedir_batch_flush (struct pagedir_batch *b)
+{
+  if (b->page_cnt > PAGEDIR_BATCH_MAX)
+    invalidate_pagedir (b->pd);
+  else
+    {
+      size_t i;
+
+      for (i = 0; i < b->page_cnt; i++)
+        invalidate_page (b->pd, b->pages[i]);
+    }
+  b->page_cnt = 0;
+}
+
 /* Loads page directory PD into the CPU's page directory base
    register. */
 void
@@ -261,3 +318,14 @@ invalidate_pagedir (uint32_t *pd)
       pagedir_activate (pd);
     } 
 }
+
+/* Invalidates the TLB entry for VADDR if PD is the active page
+   directory.  This is all a change to a single page table entry
+   needs, and unlike invalidate_pagedir() it keeps the TLB entries
+   of every other page. */
+static void
+invalidate_page (uint32_t *pd, const void *vaddr)
+{
+  if (active_pd () == pd)
+    tlb_invalidate_page (vaddr);
+}
@@ -2,7 +2,22 @@
 #define USERPROG_PAGEDIR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include "threads/pte.h"
+
+/* Most pages a batch invalidates one at a time.  Past this, it
+   flushes the whole TLB instead. */
+#define PAGEDIR_BATCH_MAX TLB_INVALIDATE_MAX
+
+/* A batch of page table entry changes in one page directory whose
+   TLB invalidations are put off and done together. */
+struct pagedir_batch
+  {
+    uint32_t *pd;                       /* Page directory changed. */
+    size_t page_cnt;                    /* Number of pages changed. */
+    void *pages[PAGEDIR_BATCH_MAX];     /* The pages, if few enough. */
+  };
 
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
@@ -13,6 +28,9 @@ bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
+void pagedir_batch_init (struct pagedir_batch *, uint32_t *pd);
+void pagedir_batch_clear_page (struct pagedir_batch *, void *upage);
+void pagedir_batch_flush (struct pagedir_batch *);
 void pagedir_activate (uint32_t *pd);
 
 #endif /* userprog/pagedir.h */
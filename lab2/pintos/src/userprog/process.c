@@ -8,6 +8,7 @@
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
 #include "userprog/tss.h"
+#include "devices/timer.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
@@ -17,10 +18,32 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
+/* Time spent starting processes that loaded successfully, in
+   CPU cycles: in process_execute() up to creating the thread and
+   in start_process() until the jump to user mode, not counting
+   time spent waiting to be scheduled.  Mostly allocating,
+   zeroing and filling pages. */
+static long long exec_cnt;      /* # of processes started. */
+static long long exec_cycles;   /* Sum of their start times. */
+
+/* Passed from process_execute() to start_process(), in a page of
+   its own. */
+struct exec_info
+  {
+    uint64_t cycles;            /* Cycles spent in process_execute(). */
+    char file_name[PGSIZE - sizeof (uint64_t)];
+  };
+
+static void account_exec (uint64_t cycles);
+
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
    before process_execute() returns.  Returns the new process's
@@ -28,29 +51,35 @@ static bool load (const char *cmdline, void (**eip) (void), void **esp);
 tid_t
 process_execute (const char *file_name) 
 {
-  char *fn_copy;
+  uint64_t start = timer_cycles ();
+  struct exec_info *info;
   tid_t tid;
 
   /* Make a copy of FILE_NAME.
      Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
+  info = palloc_get_page (0);
+  if (info == NULL)
     return TID_ERROR;
-  strlcpy (fn_copy, file_name, PGSIZE);
+  strlcpy (info->file_name, file_name, sizeof info->file_name);
 
-  /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
+  /* Create a new thread to execute FILE_NAME.  The new thread
+     owns INFO from here on, so the time spent so far goes along
+     with it, to be counted only if the load succeeds. */
+  info->cycles = timer_cycles () - start;
+  tid = thread_create (file_name, PRI_DEFAULT, start_process, info);
   if (tid == TID_ERROR)
-    palloc_free_page (fn_copy); 
+    palloc_free_page (info); 
   return tid;
 }
 
 /* A thread function that loads a user process and starts it
    running. */
 static void
-start_process (void *file_name_)
+start_process (void *info_)
 {
-  char *file_name = file_name_;
+  uint64_t start = timer_cycles ();
+  struct exec_info *info = info_;
+  uint64_t cycles = info->cycles;
   struct intr_frame if_;
   bool success;
 
@@ -59,12 +88,13 @@ start_process (void *file_name_)
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (file_name, &if_.eip, &if_.esp);
+  success = load (info->file_name, &if_.eip, &if_.esp);
 
   /* If load failed, quit. */
-  palloc_free_page (file_name);
+  palloc_free_page (info);
   if (!success) 
     thread_exit ();
+  account_exec (cycles + (timer_cycles () - start));
 
   /* Start the user process by simulating a return from an
      interrupt, implemented by intr_exit (in
@@ -76,6 +106,24 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/* Counts one more process as started, taking CYCLES to start. */
+static void
+account_exec (uint64_t cycles)
+{
+  enum intr_level old_level = intr_disable ();
+  exec_cycles += cycles;
+  exec_cnt++;
+  intr_set_level (old_level);
+}
+
+/* Prints statistics about starting processes. */
+void
+process_print_stats (void)
+{
+  printf ("Exec: %lld processes started, %lld cycles each on average\n",
+          exec_cnt, exec_cnt > 0 ? exec_cycles / exec_cnt : 0);
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -103,6 +151,14 @@ process_exit (void)
   pd = cur->pagedir;
   if (pd != NULL) 
     {
+#ifdef VM
+      /* Write back mapped files and take our frames out of the
+         frame table while the page directory they are mapped in
+         still exists. */
+      mmap_table_destroy (&cur->mappings);
+      page_table_destroy (&cur->pages);
+#endif
+
       /* Correct ordering here is crucial.  We must set
          cur->pagedir to NULL before switching page directories,
          so that a timer interrupt can't switch back to the
@@ -114,6 +170,10 @@ process_exit (void)
       pagedir_activate (NULL);
       pagedir_destroy (pd);
     }
+#ifdef VM
+  file_close (cur->exec_file);
+  cur->exec_file = NULL;
+#endif
 }
 
 /* Sets up the CPU for running user code in the current
@@ -219,6 +279,15 @@ load (const char *file_name, void (**eip) (void), void **esp)
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
     goto done;
+#ifdef VM
+  if (!page_table_init (&t->pages))
+    {
+      pagedir_destroy (t->pagedir);
+      t->pagedir = NULL;
+      goto done;
+    }
+  mmap_table_init (&t->mappings);
+#endif
   process_activate ();
 
   /* Open executable file. */
@@ -312,13 +381,27 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
  done:
   /* We arrive here whether the load is successful or not. */
+#ifdef VM
+  /* Pages are read from the executable as they are touched, so
+     keep it open until the process exits. */
+  if (success)
+    {
+      /* Its pages may be shared with other processes, so they
+         must not change under them. */
+      file_deny_write (file);
+      t->exec_file = file;
+    }
+  else
+#endif
   file_close (file);
   return success;
 }
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -377,6 +460,9 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With VM, the pages are only recorded in the supplemental page
+   table, and read or zeroed when the process first touches them.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -387,6 +473,28 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifdef VM
+  while (read_bytes > 0 || zero_bytes > 0) 
+    {
+      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+      size_t page_zero_bytes = PGSIZE - page_read_bytes;
+      bool success;
+
+      if (page_read_bytes > 0)
+        success = page_add_file (upage, file, ofs, page_read_bytes,
+                                 writable);
+      else
+        success = page_add_zero (upage, writable);
+      if (!success)
+        return false;
+
+      read_bytes -= page_read_bytes;
+      zero_bytes -= page_zero_bytes;
+      ofs += page_read_bytes;
+      upage += PGSIZE;
+    }
+  return true;
+#else
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
@@ -422,13 +530,21 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       upage += PGSIZE;
     }
   return true;
+#endif
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
+   user virtual memory.  With VM, the page is zeroed when it is
+   first touched. */
 static bool
 setup_stack (void **esp) 
 {
+#ifdef VM
+  if (!page_add_zero (((uint8_t *) PHYS_BASE) - PGSIZE, true))
+    return false;
+  *esp = PHYS_BASE;
+  return true;
+#else
   uint8_t *kpage;
   bool success = false;
 
@@ -442,8 +558,10 @@ setup_stack (void **esp)
         palloc_free_page (kpage);
     }
   return success;
+#endif
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -463,3 +581,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
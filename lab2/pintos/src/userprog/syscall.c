@@ -15,6 +15,11 @@ syscall_init (void)
 static void
 syscall_handler (struct intr_frame *f UNUSED) 
 {
+#ifdef VM
+  /* Page faults on user memory in the kernel need this to tell
+     whether to grow the stack. */
+  thread_current ()->user_esp = f->esp;
+#endif
   printf ("system call!\n");
   thread_exit ();
 }
@@ -0,0 +1,285 @@
+/* Benchmarks the kernel's bitmap searches on the host.
+
+   Builds lib/kernel/bitmap.c into a host program and times
+   bitmap_scan(), bitmap_count(), and bitmap_contains() over
+   maps of millions of bits filled in several patterns, with and
+   without a summary, against a bit-at-a-time reference that
+   works the way bitmap.c used to.  Prints one line of KEY=VALUE
+   pairs per map, operation, and variant, and exits with a
+   failure status if any two variants disagree.
+
+   Build with "make bitmap-bench" in this directory. */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+void hex_dump (uintptr_t ofs, const void *, size_t size, bool ascii);
+#include "../lib/kernel/bitmap.c"
+
+/* Ways to fill a map. */
+enum pattern
+  {
+    SPARSE,             /* Mostly clear, one bit in 4096 set. */
+    HALF,               /* Each bit set with probability 1/2. */
+    RUNS,               /* Runs of 1 to 64 bits, alternating. */
+    NEARLY_FULL         /* All set but a run of 64 at the end. */
+  };
+
+static const char *pattern_names[] = {"sparse", "half", "runs", "nearly-full"};
+
+/* Map sizes, in bits. */
+static const size_t sizes[] = {1 << 20, 1 << 22, 1 << 24};
+
+/* Largest map that the bit-at-a-time reference is run on. */
+#define REFERENCE_MAX (1 << 22)
+
+/* Run lengths searched for. */
+static const size_t scan_cnts[] = {1, 8, 64};
+
+/* Times each operation is repeated, at most. */
+#define REPEATS 16
+
+static unsigned long long seed = 1;
+static int failures;
+
+/* Returns a pseudo-random number. */
+static unsigned long
+rand_ulong (void)
+{
+  seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+  return seed >> 33;
+}
+
+/* Returns the current time in nanoseconds. */
+static long long
+now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Fills B according to PATTERN. */
+static void
+fill (struct bitmap *b, enum pattern pattern)
+{
+  size_t bit_cnt = bitmap_size (b);
+  size_t i, len;
+  bool value;
+
+  bitmap_set_all (b, false);
+  switch (pattern)
+    {
+    case SPARSE:
+      for (i = 0; i < bit_cnt / 4096; i++)
+        bitmap_mark (b, rand_ulong () % bit_cnt);
+      break;
+
+    case HALF:
+      for (i = 0; i < bit_cnt; i++)
+        if (rand_ulong () & 1)
+          bitmap_mark (b, i);
+      break;
+
+    case RUNS:
+      for (i = 0, value = true; i < bit_cnt; i += len, value = !value)
+        {
+          len = 1 + rand_ulong () % 64;
+          if (len > bit_cnt - i)
+            len = bit_cnt - i;
+          bitmap_set_multiple (b, i, len, value);
+        }
+      break;
+
+    case NEARLY_FULL:
+      bitmap_set_all (b, true);
+      bitmap_set_multiple (b, bit_cnt - 64, 64, false);
+      break;
+    }
+}
+
+/* The old bitmap_contains(), one bit at a time. */
+static bool
+ref_contains (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      return true;
+  return false;
+}
+
+/* The old bitmap_scan(), one bit at a time. */
+static size_t
+ref_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  if (cnt <= bitmap_size (b))
+    {
+      size_t last = bitmap_size (b) - cnt;
+      size_t i;
+      for (i = start; i <= last; i++)
+        if (!ref_contains (b, i, cnt, !value))
+          return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* The old bitmap_count(), one bit at a time. */
+static size_t
+ref_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i, value_cnt = 0;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      value_cnt++;
+  return value_cnt;
+}
+
+/* Operations timed. */
+enum op { SCAN, COUNT, CONTAINS };
+
+/* Runs operation OP with argument CNT on B once, using the
+   reference version if REFERENCE is true, and returns its
+   result. */
+static size_t
+run_op (const struct bitmap *b, enum op op, size_t cnt, bool reference)
+{
+  size_t bit_cnt = bitmap_size (b);
+
+  switch (op)
+    {
+    case SCAN:
+      return (reference ? ref_scan : bitmap_scan) (b, 0, cnt, false);
+    case COUNT:
+      return (reference ? ref_count : bitmap_count) (b, 0, bit_cnt, true);
+    case CONTAINS:
+      return (reference ? ref_contains : bitmap_contains) (b, 0, bit_cnt,
+                                                            false);
+    }
+  abort ();
+}
+
+/* Times operation OP, named NAME, with argument CNT on B and
+   prints the result for map PATTERN as variant VARIANT.  Returns
+   the operation's result. */
+static size_t
+time_op (const struct bitmap *b, enum pattern pattern, const char *name,
+         enum op op, size_t cnt, const char *variant, bool reference)
+{
+  long long start, elapsed;
+  size_t result = 0;
+  int i, repeats = reference ? 1 : REPEATS;
+
+  start = now_ns ();
+  for (i = 0; i < repeats; i++)
+    result = run_op (b, op, cnt, reference);
+  elapsed = now_ns () - start;
+
+  printf ("bits=%zu pattern=%s op=%s cnt=%zu variant=%s result=%lld "
+          "ns_per_op=%lld ns_per_kbit=%.3f\n",
+          bitmap_size (b), pattern_names[pattern], name, cnt, variant,
+          result == BITMAP_ERROR ? -1LL : (long long) result,
+          elapsed / repeats,
+          (double) elapsed / repeats / (bitmap_size (b) / 1024.0));
+  return result;
+}
+
+/* Times operation OP on B in every variant and checks that they
+   agree. */
+static void
+compare_op (struct bitmap *b, struct bitmap *summarized,
+            enum pattern pattern, const char *name, enum op op, size_t cnt)
+{
+  size_t word, summary, reference;
+
+  word = time_op (b, pattern, name, op, cnt, "word", false);
+  summary = time_op (summarized, pattern, name, op, cnt, "summary", false);
+  if (summary != word)
+    {
+      printf ("MISMATCH: summary gave %zu, word gave %zu\n", summary, word);
+      failures++;
+    }
+  if (bitmap_size (b) <= REFERENCE_MAX)
+    {
+      reference = time_op (b, pattern, name, op, cnt, "bit", true);
+      if (reference != word)
+        {
+          printf ("MISMATCH: bit gave %zu, word gave %zu\n",
+                  reference, word);
+          failures++;
+        }
+    }
+}
+
+int
+main (void)
+{
+  size_t i, j, k;
+
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    for (j = 0; j <= NEARLY_FULL; j++)
+      {
+        struct bitmap *b = bitmap_create (sizes[i]);
+        struct bitmap *summarized = bitmap_create (sizes[i]);
+
+        if (b == NULL || summarized == NULL
+            || !bitmap_add_summary (summarized))
+          {
+            fprintf (stderr, "bitmap-bench: out of memory\n");
+            return EXIT_FAILURE;
+          }
+
+        /* Fill both maps the same way. */
+        seed = 1;
+        fill (b, j);
+        seed = 1;
+        fill (summarized, j);
+
+        for (k = 0; k < sizeof scan_cnts / sizeof *scan_cnts; k++)
+          compare_op (b, summarized, j, "scan", SCAN, scan_cnts[k]);
+        compare_op (b, summarized, j, "count", COUNT, 0);
+        compare_op (b, summarized, j, "contains", CONTAINS, 0);
+
+        bitmap_destroy (b);
+        bitmap_destroy (summarized);
+      }
+
+  if (failures > 0)
+    {
+      printf ("%d mismatches\n", failures);
+      return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+/* Called by ASSERT in bitmap.c. */
+void
+debug_panic (const char *file, int line, const char *function,
+             const char *message, ...)
+{
+  va_list args;
+
+  fprintf (stderr, "%s:%d: %s(): ", file, line, function);
+  va_start (args, message);
+  vfprintf (stderr, message, args);
+  va_end (args);
+  putc ('\n', stderr);
+  abort ();
+}
+
+/* Called by bitmap_dump() in bitmap.c, which is never used
+   here. */
+void
+hex_dump (uintptr_t ofs, const void *buf, size_t size, bool ascii)
+{
+  (void) ofs, (void) buf, (void) size, (void) ascii;
+  abort ();
+}
@@ -0,0 +1,346 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+
+/* Frame table.
+
+   Every frame that holds a page of a process is recorded here
+   with the page and the process that owns it.  When the user
+   pool runs out, frame_alloc() takes a frame from some process
+   instead, chosen by the clock algorithm: a hand sweeps around
+   the table, and each frame whose page was accessed since the
+   hand last passed gets a second chance, with its accessed bit
+   cleared, while the first one that was not is evicted.  On its
+   first sweep, the hand also passes over pages that were used
+   in a recent working set sample, by their ages (see wset.c).
+   The evicted page is written to swap if it is dirty (see
+   page_evict()) and the frame goes to the new page.
+
+   Evicting a page means changing its owner's page table and
+   supplemental page table, which are protected by the owner's
+   pages_lock.  The hand only tries that lock, skipping frames
+   whose owners are busy, so that it never waits with frame_lock
+   held.  A frame is pinned from the time frame_alloc() returns
+   it until its page is filled and mapped, so that it is not
+   evicted half-done.
+
+   frame_scan() goes around the table too, with a cursor of its
+   own, for the same-page merging scanner (see merge.c).  It
+   locks owners the same way and pins each frame while the
+   scanner looks at it, and counts the laps its cursor has gone
+   around the table. */
+
+/* Frames in clock order, the hand, and the number of frames.
+   Protected by frame_lock. */
+static struct list frames;
+static struct list_elem *hand;
+static struct list_elem *scan_pos;
+static unsigned scan_lap;
+static size_t frame_cnt;
+static struct lock frame_lock;
+
+/* Cache of struct frame. */
+static struct slab_cache frame_cache;
+
+/* Statistics. */
+static long long evict_cnt;     /* Frames taken from another page. */
+static long long swept_cnt;     /* Frames the hand passed over. */
+
+static struct frame *evict (void);
+static void insert_frame (struct frame *, struct page *, struct thread *);
+static void remove_frame (struct frame *);
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  list_init (&frames);
+  hand = scan_pos = list_end (&frames);
+  lock_init (&frame_lock);
+  slab_cache_init (&frame_cache, "frame", sizeof (struct frame), NULL, NULL);
+}
+
+/* Obtains a frame for page P of the current process, from the
+   user pool if possible, otherwise by evicting another page.
+   FLAGS may include PAL_ZERO.  The frame is pinned; call
+   frame_unpin() once P is mapped to it.  Returns a null pointer
+   if no frame can be obtained. */
+struct frame *
+frame_alloc (struct page *p, enum palloc_flags flags)
+{
+  struct frame *f = NULL;
+  void *kpage;
+
+  kpage = palloc_get_page (PAL_USER | flags);
+  if (kpage != NULL)
+    {
+      f = slab_alloc (&frame_cache);
+      if (f == NULL)
+        {
+          palloc_free_page (kpage);
+          return NULL;
+        }
+      f->kpage = kpage;
+    }
+  else
+    {
+      f = evict ();
+      if (f == NULL)
+        return NULL;
+      if (flags & PAL_ZERO)
+        memset (f->kpage, 0, PGSIZE);
+    }
+
+  insert_frame (f, p, thread_current ());
+  return f;
+}
+
+/* Obtains a frame for page P of the current process, like
+   frame_alloc(), but only if the user pool has one free: never
+   evicts a page.  Useful for reading pages ahead of need.
+   Returns a null pointer if no frame is free. */
+struct frame *
+frame_try_alloc (struct page *p, enum palloc_flags flags)
+{
+  struct frame *f;
+  void *kpage;
+
+  kpage = palloc_get_page (PAL_USER | flags);
+  if (kpage == NULL)
+    return NULL;
+  f = slab_alloc (&frame_cache);
+  if (f == NULL)
+    {
+      palloc_free_page (kpage);
+      return NULL;
+    }
+  f->kpage = kpage;
+  insert_frame (f, p, thread_current ());
+  return f;
+}
+
+/* Puts KPAGE, a page of the user pool that holds page P of
+   process OWNER but is not in the frame table, back into the
+   table, pinned, so that it can be evicted again once it is
+   unpinned.  Returns the frame, or a null pointer if memory
+   allocation fails. */
+struct frame *
+frame_adopt (struct page *p, struct thread *owner, void *kpage)
+{
+  struct frame *f = slab_alloc (&frame_cache);
+
+  if (f == NULL)
+    return NULL;
+  f->kpage = kpage;
+  insert_frame (f, p, owner);
+  return f;
+}
+
+/* Pins frame F, so that it will not be evicted, unless it is
+   pinned already.  Returns true if successful, false if F was
+   already pinned. */
+bool
+frame_try_pin (struct frame *f)
+{
+  bool success;
+
+  lock_acquire (&frame_lock);
+  success = !f->pinned;
+  f->pinned = true;
+  lock_release (&frame_lock);
+  return success;
+}
+
+/* Allows frame F to be evicted. */
+void
+frame_unpin (struct frame *f)
+{
+  lock_acquire (&frame_lock);
+  ASSERT (f->pinned);
+  f->pinned = false;
+  lock_release (&frame_lock);
+}
+
+/* Removes frame F from the frame table and frees it.  Its page
+   is freed too if FREE_KPAGE is true, otherwise that is left to
+   the page directory it is mapped in. */
+void
+frame_free (struct frame *f, bool free_kpage)
+{
+  lock_acquire (&frame_lock);
+  remove_frame (f);
+  lock_release (&frame_lock);
+
+  if (free_kpage)
+    palloc_free_page (f->kpage);
+  slab_free (&frame_cache, f);
+}
+
+/* Calls FUNC on up to CNT frames, going around the frame table
+   from where the previous call left off.  Frames that are pinned
+   or whose owners are busy are skipped.  FUNC is called without
+   frame_lock, with the frame pinned and its owner's pages_lock
+   held, and returns true if it freed the frame.  Returns the
+   number of frames FUNC was called on. */
+size_t
+frame_scan (size_t cnt, frame_scan_func *func)
+{
+  size_t step_cnt, visit_cnt = 0;
+
+  lock_acquire (&frame_lock);
+  for (step_cnt = 0; step_cnt < cnt && frame_cnt > 0; step_cnt++)
+    {
+      struct frame *f;
+      struct lock *owner_lock;
+      bool freed;
+
+      if (scan_pos == list_end (&frames))
+        {
+          scan_pos = list_begin (&frames);
+          scan_lap++;
+        }
+      f = list_entry (scan_pos, struct frame, elem);
+      scan_pos = list_next (scan_pos);
+      owner_lock = &f->owner->pages_lock;
+      if (f->pinned || !lock_try_acquire (owner_lock))
+        continue;
+
+      f->pinned = true;
+      lock_release (&frame_lock);
+      freed = func (f);
+      visit_cnt++;
+      lock_acquire (&frame_lock);
+      if (!freed)
+        f->pinned = false;
+      lock_release (owner_lock);
+    }
+  lock_release (&frame_lock);
+  return visit_cnt;
+}
+
+/* Returns the number of times frame_scan() has gone all the way
+   around the frame table. */
+unsigned
+frame_scan_lap (void)
+{
+  unsigned lap;
+
+  lock_acquire (&frame_lock);
+  lap = scan_lap;
+  lock_release (&frame_lock);
+  return lap;
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void)
+{
+  printf ("Frames: %zu in use, %lld evicted, %lld swept by the hand\n",
+          frame_cnt, evict_cnt, swept_cnt);
+}
+
+/* Chooses a frame by the clock algorithm, evicts its page, and
+   returns it, out of the frame table.  Returns a null pointer if
+   no page can be evicted. */
+static struct frame *
+evict (void)
+{
+  size_t step_cnt;
+
+  lock_acquire (&frame_lock);
+
+  /* Two sweeps clear every accessed bit, and the second ignores
+     ages, so if the hand gets that far without finding a frame,
+     each one left is pinned, has a busy owner, or could not be
+     evicted. */
+  for (step_cnt = 0; step_cnt < 2 * frame_cnt + 1 && frame_cnt > 0;
+       step_cnt++)
+    {
+      struct frame *f;
+      struct lock *owner_lock;
+      bool locked;
+
+      if (hand == list_end (&frames))
+        hand = list_begin (&frames);
+      f = list_entry (hand, struct frame, elem);
+      hand = list_next (hand);
+      swept_cnt++;
+      if (f->pinned)
+        continue;
+
+      /* Lock the owner's pages, unless they are ours and locked
+         already. */
+      owner_lock = &f->owner->pages_lock;
+      locked = !lock_held_by_current_thread (owner_lock);
+      if (locked && !lock_try_acquire (owner_lock))
+        continue;
+
+      if (!page_was_accessed (f->page)
+          && (f->page->age == 0 || step_cnt >= frame_cnt))
+        {
+          /* Take F out of the table while its page is written
+             out, so that no one else chooses it. */
+          remove_frame (f);
+          evict_cnt++;
+          lock_release (&frame_lock);
+
+          if (page_evict (f->page))
+            {
+              if (locked)
+                lock_release (owner_lock);
+              return f;
+            }
+
+          /* Could not evict it, so put it back. */
+          lock_acquire (&frame_lock);
+          list_insert (hand, &f->elem);
+          frame_cnt++;
+          evict_cnt--;
+        }
+
+      if (locked)
+        lock_release (owner_lock);
+    }
+
+  lock_release (&frame_lock);
+  return NULL;
+}
+
+/* Makes F hold page P of process OWNER, pinned, and inserts it
+   in the frame table just behind the hand, so that it is the last
+   frame the hand reaches. */
+static void
+insert_frame (struct frame *f, struct page *p, struct thread *owner)
+{
+  f->page = p;
+  f->owner = owner;
+  f->pinned = true;
+
+  lock_acquire (&frame_lock);
+  list_insert (hand, &f->elem);
+  frame_cnt++;
+  lock_release (&frame_lock);
+}
+
+/* Removes F from the frame table, moving the hand and the scan
+   cursor past it if necessary.  The caller must hold
+   frame_lock. */
+static void
+remove_frame (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  if (scan_pos == &f->elem)
+    scan_pos = list_next (scan_pos);
+  list_remove (&f->elem);
+  frame_cnt--;
+}
@@ -0,0 +1,37 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "threads/palloc.h"
+
+struct page;
+struct thread;
+
+/* A frame holding a user page. */
+struct frame
+  {
+    void *kpage;                /* Kernel virtual address. */
+    struct page *page;          /* Page it holds. */
+    struct thread *owner;       /* Process whose page it is. */
+    bool pinned;                /* Not to be evicted? */
+    struct list_elem elem;      /* Element in frame table. */
+  };
+
+/* Called by frame_scan() on frame F.  Returns true if it freed
+   F. */
+typedef bool frame_scan_func (struct frame *f);
+
+void frame_init (void);
+struct frame *frame_alloc (struct page *, enum palloc_flags);
+struct frame *frame_try_alloc (struct page *, enum palloc_flags);
+struct frame *frame_adopt (struct page *, struct thread *owner, void *kpage);
+bool frame_try_pin (struct frame *);
+void frame_unpin (struct frame *);
+void frame_free (struct frame *, bool free_kpage);
+size_t frame_scan (size_t cnt, frame_scan_func *);
+unsigned frame_scan_lap (void);
+void frame_print_stats (void);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,142 @@
+#include "vm/merge.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/share.h"
+
+/* Same-page merging.
+
+   Processes running the same program often end up with data
+   pages whose contents are byte for byte the same.  If the -mg
+   option turns merging on, a scanner thread at the lowest
+   priority goes around the frame table a few pages at a time,
+   hashing each page's contents, and merges pages that are
+   identical into one shared frame that they all map read-only.
+   A process that writes a merged page gets its own copy again
+   (see page_merge() and share.c).
+
+   A page is merged only if its checksum has not changed since
+   the scanner last saw it, so that pages being written are left
+   alone.  Such a page is merged with a shared page of the same
+   contents, if there is one, or with the zero page if it is all
+   zeros.  Otherwise it becomes a shared page itself if another
+   page with the same checksum was seen recently, so that the
+   other page is merged with it the next time around.  A page
+   that matches nothing keeps a frame of its own, which, unlike a
+   shared one, can still be evicted.  So does a merged page whose
+   partners change or go away before they are merged with it, or
+   are copied again later: before each batch, the scanner gives
+   the frame of each shared page left with a single page mapping
+   it back to that page (see share_split_lonely()).  Recently
+   seen checksums are kept in a small table that forgets them as
+   they collide. */
+
+/* Ticks between runs of the scanner. */
+#define MERGE_INTERVAL (TIMER_FREQ / 10)
+
+/* Number of recently seen checksums remembered. */
+#define SEEN_CNT 1024
+
+/* A page seen by the scanner.  PAGE is only compared, never
+   followed, so it does not matter if the page is gone. */
+struct seen
+  {
+    unsigned checksum;          /* Checksum of its contents. */
+    const struct page *page;    /* The page. */
+  };
+
+/* Pages scanned a second, or 0 if merging is off. */
+static size_t scan_rate;
+
+/* Recently seen stable pages, indexed by checksum. */
+static struct seen seen[SEEN_CNT];
+
+/* Statistics. */
+static long long scanned_cnt;   /* Pages hashed. */
+static long long merged_cnt;    /* Pages merged. */
+static long long scan_cycles;   /* CPU cycles spent scanning. */
+
+static thread_func merger;
+static frame_scan_func merge_frame;
+
+/* Starts the scanner thread, if merging is on. */
+void
+merge_init (void)
+{
+  if (scan_rate > 0)
+    thread_create ("merge", PRI_MIN, merger, NULL);
+}
+
+/* Sets the number of pages to scan a second to PAGE_CNT and
+   returns the previous number.  Zero turns merging off.  Takes
+   effect only before merge_init(). */
+size_t
+merge_set_rate (size_t page_cnt)
+{
+  size_t old_rate = scan_rate;
+
+  scan_rate = page_cnt;
+  return old_rate;
+}
+
+/* Prints statistics about same-page merging. */
+void
+merge_print_stats (void)
+{
+  printf ("Merging: %lld pages scanned in %lld cycles, %lld merged\n",
+          scanned_cnt, scan_cycles, merged_cnt);
+}
+
+/* The scanner thread.  Scans scan_rate pages a second, in
+   batches every MERGE_INTERVAL ticks. */
+static void
+merger (void *aux UNUSED)
+{
+  size_t batch = scan_rate * MERGE_INTERVAL / TIMER_FREQ;
+
+  if (batch == 0)
+    batch = 1;
+  for (;;)
+    {
+      uint64_t start;
+
+      timer_sleep (MERGE_INTERVAL);
+      start = timer_cycles ();
+      share_split_lonely ();
+      frame_scan (batch, merge_frame);
+      scan_cycles += timer_cycles () - start;
+    }
+}
+
+/* Merges the page in frame F, if it is stable and has a match.
+   Called by frame_scan(), with F pinned and its owner's
+   pages_lock held.  Returns true if F was freed. */
+static bool
+merge_frame (struct frame *f)
+{
+  struct page *p = f->page;
+  unsigned checksum = hash_bytes (f->kpage, PGSIZE);
+  struct seen *s = &seen[checksum % SEEN_CNT];
+  bool create;
+
+  scanned_cnt++;
+  if (checksum != p->checksum)
+    {
+      /* Changed since we last saw it, or new. */
+      p->checksum = checksum;
+      return false;
+    }
+
+  create = s->checksum == checksum && s->page != p;
+  s->checksum = checksum;
+  s->page = p;
+  if (!page_merge (p, create))
+    return false;
+  merged_cnt++;
+  return true;
+}
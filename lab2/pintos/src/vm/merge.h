@@ -0,0 +1,10 @@
+#ifndef VM_MERGE_H
+#define VM_MERGE_H
+
+#include <stddef.h>
+
+void merge_init (void);
+size_t merge_set_rate (size_t page_cnt);
+void merge_print_stats (void);
+
+#endif /* vm/merge.h */
@@ -0,0 +1,166 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/* Memory-mapped files.
+
+   mmap_map() maps a file into the current process's address
+   space as pages of type PAGE_MMAP in its supplemental page
+   table.  Nothing is read until the process touches a page,
+   which is then read from the file straight into its frame, so
+   a process can work through a file without copying it through
+   buffers of its own.  Pages the process dirties are written
+   back to the file when they are evicted, when the file is
+   unmapped, and when the process exits; clean pages are just
+   dropped.
+
+   Each mapping has its own reopened file, so that it stays
+   valid after the file it was created from is closed. */
+
+/* A mapping of a file. */
+struct mapping
+  {
+    mapid_t id;                 /* Identifier returned to the process. */
+    struct file *file;          /* File mapped. */
+    uint8_t *base;              /* First page mapped. */
+    size_t page_cnt;            /* Number of pages mapped. */
+    struct list_elem elem;      /* Element in process's mappings. */
+  };
+
+static struct mapping *find_mapping (mapid_t);
+static void unmap (struct mapping *, size_t page_cnt);
+
+/* Initializes MAPPINGS, the current thread's, as an empty list
+   of mappings. */
+void
+mmap_table_init (struct list *mappings)
+{
+  ASSERT (mappings == &thread_current ()->mappings);
+
+  list_init (mappings);
+}
+
+/* Unmaps all of MAPPINGS, the current thread's, writing back
+   their dirty pages.  Must be called before the thread's
+   supplemental page table is destroyed. */
+void
+mmap_table_destroy (struct list *mappings)
+{
+  ASSERT (mappings == &thread_current ()->mappings);
+
+  while (!list_empty (mappings))
+    {
+      struct mapping *m = list_entry (list_front (mappings),
+                                      struct mapping, elem);
+      unmap (m, m->page_cnt);
+    }
+}
+
+/* Maps FILE into the current process's address space starting
+   at ADDR, which must be page-aligned.  The pages past the end
+   of the file in the last page read as zeros and are not written
+   back.  Returns the new mapping's identifier, or MAP_FAILED if
+   ADDR is null or misaligned, FILE is empty, the pages would
+   overlap pages the process already has or kernel space, or
+   memory allocation fails. */
+mapid_t
+mmap_map (struct file *file, void *addr)
+{
+  struct list *mappings = &thread_current ()->mappings;
+  struct mapping *m;
+  off_t length;
+  size_t page_cnt, i;
+
+  if (addr == NULL || pg_ofs (addr) != 0 || !is_user_vaddr (addr))
+    return MAP_FAILED;
+  length = file_length (file);
+  if (length <= 0)
+    return MAP_FAILED;
+  page_cnt = DIV_ROUND_UP (length, PGSIZE);
+  if (page_cnt > (size_t) ((uint8_t *) PHYS_BASE - (uint8_t *) addr)
+                 / PGSIZE)
+    return MAP_FAILED;
+  for (i = 0; i < page_cnt; i++)
+    if (page_lookup ((uint8_t *) addr + i * PGSIZE) != NULL)
+      return MAP_FAILED;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return MAP_FAILED;
+  m->file = file_reopen (file);
+  if (m->file == NULL)
+    {
+      free (m);
+      return MAP_FAILED;
+    }
+  m->base = addr;
+  m->page_cnt = page_cnt;
+  m->id = (list_empty (mappings) ? 0
+           : list_entry (list_back (mappings), struct mapping, elem)->id + 1);
+  list_push_back (mappings, &m->elem);
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      off_t ofs = i * PGSIZE;
+      size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+
+      if (!page_add_mmap (m->base + ofs, m->file, ofs, read_bytes))
+        {
+          unmap (m, i);
+          return MAP_FAILED;
+        }
+    }
+  return m->id;
+}
+
+/* Unmaps the current process's mapping MAPPING, writing back its
+   dirty pages.  Returns true if successful, false if there is no
+   such mapping. */
+bool
+mmap_unmap (mapid_t mapping)
+{
+  struct mapping *m = find_mapping (mapping);
+
+  if (m == NULL)
+    return false;
+  unmap (m, m->page_cnt);
+  return true;
+}
+
+/* Returns the current process's mapping with identifier ID, or a
+   null pointer if there is none. */
+static struct mapping *
+find_mapping (mapid_t id)
+{
+  struct list *mappings = &thread_current ()->mappings;
+  struct list_elem *e;
+
+  for (e = list_begin (mappings); e != list_end (mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->id == id)
+        return m;
+    }
+  return NULL;
+}
+
+/* Removes the first PAGE_CNT pages of mapping M, which are all
+   the pages that were added for it, and frees M. */
+static void
+unmap (struct mapping *m, size_t page_cnt)
+{
+  size_t i;
+
+  for (i = 0; i < page_cnt; i++)
+    page_remove (m->base + i * PGSIZE);
+  file_close (m->file);
+  list_remove (&m->elem);
+  free (m);
+}
@@ -0,0 +1,18 @@
+#ifndef VM_MMAP_H
+#define VM_MMAP_H
+
+#include <list.h>
+#include <stdbool.h>
+
+struct file;
+
+/* Map region identifier, as in lib/user/syscall.h. */
+typedef int mapid_t;
+#define MAP_FAILED ((mapid_t) -1)
+
+void mmap_table_init (struct list *);
+void mmap_table_destroy (struct list *);
+mapid_t mmap_map (struct file *, void *addr);
+bool mmap_unmap (mapid_t);
+
+#endif /* vm/mmap.h */
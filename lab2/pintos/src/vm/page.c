@@ -0,0 +1,1001 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/share.h"
+#include "vm/swap.h"
+#include "vm/wset.h"
+
+/* Supplemental page table.
+
+   Each process has a hash table of the pages of its virtual
+   address space, keyed by user virtual address, that says where
+   each page's contents come from.  load() only records its
+   segments here instead of reading them in, so that starting a
+   process costs time in proportion to the number of segments
+   rather than their size.  A page gets a frame the first time
+   the process touches it, when page_fault_in() is called from
+   the page fault handler: file pages are read from the
+   executable, with the rest of the page zeroed, and zero pages
+   come from the page allocator's pre-zeroed pages when it has
+   any.  Pages a process never touches are never read at all.
+   A zero page that is first read rather than written maps the
+   shared zero page read-only instead, and gets a frame of its
+   own only when the process first writes it, so that large
+   arrays that are mostly read cost little memory.
+   The stack starts as a single zero page and grows a page at a
+   time as the process faults just below it, up to a limit.
+   After a fault on a file page, the pages after it in the file
+   that can be had without evicting anything are mapped too, more
+   of them while the process keeps going through the file in
+   order (see fault_around()).
+   Read-only file pages are not read by each process but shared
+   by all the processes that run the same executable (see
+   share.c).  Writable pages that are found to be identical are
+   merged into one shared frame too, copied again on a write
+   (see merge.c).  Pages of memory-mapped files (see mmap.c) are read
+   the same way as file pages.
+
+   Frames come from the frame table, which evicts some process's
+   page when the user pool runs out (see frame.c).  An evicted
+   page that is dirty goes to swap and is read back from there
+   the next time it is touched; one that is clean is simply
+   dropped and brought in again from its original source.  A
+   dirty page of a mapped file is written back to the file
+   instead of to swap.  A
+   page read back from swap is marked dirty, because its slot is
+   freed and swap was the only copy.
+
+   Swap I/O is clustered by virtual address.  A dirty page is
+   evicted together with the dirty, resident, recently unused
+   pages that follow it in its owner's address space, into
+   adjacent slots in one request, and a fault on a page in swap
+   reads in with it, again in one request, the pages around it
+   that sit in the adjacent slots, as long as there are free
+   frames for them.
+
+   Each page has an age, a history of whether it was accessed in
+   each of the last few intervals between working set samples,
+   which the clock uses to pass over pages still in use (see
+   wset.c).  The clock and the sampler both look at a page's
+   accessed bit, so whichever of them finds it set clears it and
+   notes it for both (see collect_accessed()).
+
+   A process's table and the state of its pages are protected by
+   its pages_lock, which is held by the process while it adds a
+   page to the table or brings one in, and by any thread evicting
+   or sampling one of its pages. */
+
+/* Most pages mapped by fault_around() on one fault. */
+#define FAULT_AROUND_MAX 16
+
+/* Default limit on the size of a stack, in pages. */
+#define STACK_LIMIT_DEFAULT 2048        /* 8 MB. */
+
+/* Limit on the size of a stack, in pages. */
+static size_t stack_limit = STACK_LIMIT_DEFAULT;
+
+/* Cache of struct page. */
+static struct slab_cache page_cache;
+
+/* Statistics. */
+static long long added_cnt[PAGE_TYPE_CNT];  /* Pages recorded. */
+static long long loaded_cnt[PAGE_TYPE_CNT]; /* Brought in from source. */
+static long long dropped_cnt;   /* Clean pages evicted. */
+static long long swapped_cnt;   /* Dirty pages evicted to swap. */
+static long long read_ahead_cnt; /* Pages read in from swap unasked. */
+static long long write_back_cnt; /* Mapped pages written to their files. */
+static long long grown_cnt;     /* Pages added to stacks on faults. */
+static long long around_cnt;    /* Pages mapped by fault_around(). */
+static long long avoided_cnt;   /* ...that were then accessed. */
+static long long unused_cnt;    /* ...that were not, when unmapped. */
+static long long zero_copied_cnt;   /* Zero pages copied on write. */
+static long long merge_copied_cnt;  /* Merged pages copied on write. */
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_destroy;
+static struct page *new_zero_page (void *upage, bool writable);
+static bool add_page (struct page *);
+static bool insert_page (struct page *);
+static struct page *find_page (struct thread *, const void *upage);
+static bool is_stack_access (const void *fault_addr, const void *esp);
+static bool page_in (struct page *, bool write);
+static bool page_in_swap (struct page *);
+static bool map_page (struct page *, bool may_evict);
+static bool map_shared (struct page *, bool may_evict);
+static bool map_zero (struct page *);
+static bool unshare (struct page *);
+static void fault_around (struct page *);
+static void settle_around (struct page *, uint32_t *pd);
+static void collect_accessed (struct page *, uint32_t *pd);
+static void write_back (struct page *);
+static struct page *read_ahead_page (struct page *, int delta);
+
+/* Initializes the supplemental page table module. */
+void
+page_init (void)
+{
+  slab_cache_init (&page_cache, "page", sizeof (struct page), NULL, NULL);
+}
+
+/* Initializes PAGES, the current thread's, as an empty
+   supplemental page table.  Returns true if successful, false if
+   memory allocation failed. */
+bool
+page_table_init (struct hash *pages)
+{
+  ASSERT (pages == &thread_current ()->pages);
+
+  lock_init (&thread_current ()->pages_lock);
+  thread_current ()->fault_next = NULL;
+  thread_current ()->fault_window = 0;
+  if (!hash_init (pages, page_hash, page_less, NULL))
+    return false;
+  wset_add (thread_current ());
+  return true;
+}
+
+/* Frees PAGES, the current thread's, and all the entries in it,
+   along with their swap slots.  Their frames are taken out of
+   the frame table, but freed along with the page directory, so
+   this must be called before the page directory is destroyed. */
+void
+page_table_destroy (struct hash *pages)
+{
+  struct lock *pages_lock = &thread_current ()->pages_lock;
+  struct pagedir_batch batch;
+  struct hash_iterator i;
+
+  ASSERT (pages == &thread_current ()->pages);
+
+  wset_remove (thread_current ());
+
+  /* Unmap shared frames, so that the page directory does not free
+     them, all with one TLB flush. */
+  lock_acquire (pages_lock);
+  pagedir_batch_init (&batch, thread_current ()->pagedir);
+  hash_first (&i, pages);
+  while (hash_next (&i))
+    {
+      struct page *p = hash_entry (hash_cur (&i), struct page, elem);
+      if (p->share != NULL)
+        pagedir_batch_clear_page (&batch, p->upage);
+    }
+  pagedir_batch_flush (&batch);
+
+  hash_destroy (pages, page_destroy);
+  lock_release (pages_lock);
+}
+
+/* Returns the current process's page that contains UPAGE, or a
+   null pointer if there is none.  The caller should hold the
+   current thread's pages_lock if the page may be in memory. */
+struct page *
+page_lookup (const void *upage)
+{
+  return find_page (thread_current (), upage);
+}
+
+/* Records that page UPAGE of the current process is to be read
+   from FILE at offset OFS, READ_BYTES bytes of it with the rest
+   zeroed, when it is first touched.  The page must be writable
+   by the process if WRITABLE is true, read-only otherwise.
+   Returns true if successful, false if UPAGE is already recorded
+   or memory allocation fails. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  struct page *p = slab_alloc (&page_cache);
+
+  ASSERT (read_bytes <= PGSIZE);
+  if (p == NULL)
+    return false;
+  p->upage = upage;
+  p->type = PAGE_FILE;
+  p->writable = writable;
+  p->file = file;
+  p->ofs = ofs;
+  p->read_bytes = read_bytes;
+  return add_page (p);
+}
+
+/* Records that page UPAGE of the current process is to be zeroed
+   when it is first touched.  The page must be writable by the
+   process if WRITABLE is true, read-only otherwise.  Returns true
+   if successful, false if UPAGE is already recorded or memory
+   allocation fails. */
+bool
+page_add_zero (void *upage, bool writable)
+{
+  struct page *p = new_zero_page (upage, writable);
+
+  return p != NULL && add_page (p);
+}
+
+/* Records that page UPAGE of the current process maps FILE at
+   offset OFS, which has READ_BYTES bytes of it, with the rest
+   zeroed.  The page is read from FILE when it is first touched
+   and written back to FILE, if it is dirty, when it is evicted
+   or removed.  Returns true if successful, false if UPAGE is
+   already recorded or memory allocation fails. */
+bool
+page_add_mmap (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes)
+{
+  struct page *p = slab_alloc (&page_cache);
+
+  ASSERT (read_bytes <= PGSIZE);
+  if (p == NULL)
+    return false;
+  p->upage = upage;
+  p->type = PAGE_MMAP;
+  p->writable = true;
+  p->file = file;
+  p->ofs = ofs;
+  p->read_bytes = read_bytes;
+  return add_page (p);
+}
+
+/* Removes page UPAGE of the current process, which must exist,
+   from its supplemental page table, unmapping it and freeing its
+   frame and swap slot.  If it is a page of a mapped file and
+   dirty, writes it back first. */
+void
+page_remove (void *upage)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  lock_acquire (&t->pages_lock);
+  p = page_lookup (upage);
+  ASSERT (p != NULL);
+  settle_around (p, t->pagedir);
+  if (p->share != NULL)
+    {
+      pagedir_clear_page (t->pagedir, p->upage);
+      share_put (p->share, p);
+    }
+  else if (p->frame != NULL)
+    {
+      pagedir_clear_page (t->pagedir, p->upage);
+      if (p->type == PAGE_MMAP && pagedir_is_dirty (t->pagedir, p->upage))
+        write_back (p);
+      frame_free (p->frame, true);
+    }
+  if (p->swap_slot != SWAP_ERROR)
+    swap_free (p->swap_slot);
+  hash_delete (&t->pages, &p->elem);
+  slab_free (&page_cache, p);
+  lock_release (&t->pages_lock);
+}
+
+/* Brings in the current process's page that contains
+   FAULT_ADDR, if it has one that is not in memory.  If it has
+   none, but FAULT_ADDR looks like an access to the stack given
+   that the process's stack pointer is ESP, grows the stack to
+   include it.  WRITE says whether the access was a write.  A
+   write to a writable page that maps a shared frame gives the
+   page a copy of its own.  Returns true if successful, false if
+   there is no such page or it cannot be brought in, in which
+   case the fault is a real one. */
+bool
+page_fault_in (const void *fault_addr, const void *esp, bool write)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+  bool success;
+
+  if (t->pagedir == NULL || !is_user_vaddr (fault_addr))
+    return false;
+
+  lock_acquire (&t->pages_lock);
+  p = page_lookup (fault_addr);
+  if (p == NULL && is_stack_access (fault_addr, esp))
+    {
+      p = new_zero_page (pg_round_down (fault_addr), true);
+      if (p != NULL && insert_page (p))
+        grown_cnt++;
+      else
+        p = NULL;
+    }
+  if (p == NULL)
+    success = false;
+  else if (p->share != NULL)
+    success = !write || (p->writable && unshare (p));
+  else if (p->frame != NULL)
+    {
+      /* Mapped again while we waited for the lock, after the
+         merging scanner unmapped it to compare it. */
+      success = !write || p->writable;
+    }
+  else
+    success = page_in (p, write);
+  lock_release (&t->pages_lock);
+  return success;
+}
+
+/* Returns true if page P, which must be in a frame, has been
+   accessed since the last call, and clears its accessed bit.  The
+   caller must hold the pages_lock of P's owner. */
+bool
+page_was_accessed (struct page *p)
+{
+  bool accessed;
+
+  collect_accessed (p, p->frame->owner->pagedir);
+  accessed = p->ref_clock;
+  p->ref_clock = false;
+  return accessed;
+}
+
+/* Takes a working set sample of page P, whose process's page
+   directory is PD: shifts P's age along by one interval, setting
+   its top bit if P was accessed since the previous sample.  The
+   caller must hold the pages_lock of P's owner.  Returns P's new
+   age. */
+unsigned
+page_sample (struct page *p, uint32_t *pd)
+{
+  if (p->frame != NULL || p->share != NULL)
+    collect_accessed (p, pd);
+  p->age = (p->age >> 1) | (p->ref_sample ? 0x80 : 0);
+  p->ref_sample = false;
+  return p->age;
+}
+
+/* Merges page P, which must be in a frame, with a shared page of
+   identical contents, if there is one, or if CREATE is true makes
+   its frame into a shared page that other pages can be merged
+   with, and maps the shared page read-only in P's place, freeing
+   P's frame.  The caller must hold the pages_lock of P's owner
+   and have P's frame pinned.  Returns true if P was merged, false
+   if P cannot be merged or there was nothing to merge it with. */
+bool
+page_merge (struct page *p, bool create)
+{
+  struct frame *f = p->frame;
+  uint32_t *pd = f->owner->pagedir;
+  struct share *s;
+  bool dirty;
+
+  ASSERT (lock_held_by_current_thread (&f->owner->pages_lock));
+
+  if (p->type == PAGE_MMAP || !p->writable)
+    return false;
+
+  /* Unmap P so that its owner cannot write it while we compare.
+     The owner waits for its pages_lock if it touches it. */
+  collect_accessed (p, pd);
+  dirty = pagedir_is_dirty (pd, p->upage);
+  pagedir_clear_page (pd, p->upage);
+
+  p->checksum = hash_bytes (f->kpage, PGSIZE);
+  s = share_merge (p, f->kpage, p->checksum, create);
+  if (s == NULL)
+    {
+      pagedir_set_page (pd, p->upage, f->kpage, true);
+      if (dirty)
+        pagedir_set_dirty (pd, p->upage, true);
+      return false;
+    }
+
+  pagedir_set_page (pd, p->upage, s->kpage, false);
+  p->share = s;
+  p->frame = NULL;
+  frame_free (f, s->kpage != f->kpage);
+  return true;
+}
+
+/* Gives page P, which maps a merged page that no other page
+   maps, the merged page's frame as an ordinary frame of its own
+   in the frame table, mapped writable.  The caller must hold the
+   pages_lock of P's owner and the lock of the table of shares,
+   and frees the merged page if this succeeds.  Returns true if
+   successful, false if memory allocation failed. */
+bool
+page_unmerge (struct page *p)
+{
+  uint32_t *pd = p->owner->pagedir;
+  void *kpage = p->share->kpage;
+  struct frame *f;
+
+  ASSERT (lock_held_by_current_thread (&p->owner->pages_lock));
+  ASSERT (p->writable);
+
+  f = frame_adopt (p, p->owner, kpage);
+  if (f == NULL)
+    return false;
+  collect_accessed (p, pd);
+  pagedir_clear_page (pd, p->upage);
+  if (!pagedir_set_page (pd, p->upage, kpage, true))
+    {
+      pagedir_set_page (pd, p->upage, kpage, false);
+      frame_free (f, false);
+      return false;
+    }
+
+  /* The contents may no longer match the page's file or swap
+     slot, so they must be written out if it is evicted. */
+  pagedir_set_dirty (pd, p->upage, true);
+  p->share = NULL;
+  p->frame = f;
+  frame_unpin (f);
+  return true;
+}
+
+/* Sets the most pages that a process's stack may grow to to
+   PAGE_CNT and returns the previous limit. */
+size_t
+page_set_stack_limit (size_t page_cnt)
+{
+  size_t old_limit = stack_limit;
+
+  if (page_cnt > (uintptr_t) PHYS_BASE / PGSIZE)
+    page_cnt = (uintptr_t) PHYS_BASE / PGSIZE;
+  stack_limit = page_cnt;
+  return old_limit;
+}
+
+/* Evicts page P from its frame, which the caller has taken out
+   of the frame table, writing P to swap if it is dirty, along
+   with the pages that follow it that can go with it.  The caller
+   must hold the pages_lock of P's owner.  Returns true if
+   successful.  Returns false if P is dirty but swap is full, in
+   which case P stays in its frame, mapped as before. */
+bool
+page_evict (struct page *p)
+{
+  struct thread *owner = p->frame->owner;
+  uint32_t *pd = owner->pagedir;
+  struct page *cluster[SWAP_CLUSTER];
+  void *kpages[SWAP_CLUSTER];
+  struct pagedir_batch batch;
+  size_t cnt, written, slot, i;
+
+  ASSERT (lock_held_by_current_thread (&owner->pages_lock));
+  ASSERT (p->swap_slot == SWAP_ERROR);
+
+  /* Unmap P before looking at its dirty bit, so that the process
+     cannot dirty it after we look. */
+  settle_around (p, pd);
+  pagedir_clear_page (pd, p->upage);
+  if (!pagedir_is_dirty (pd, p->upage))
+    {
+      dropped_cnt++;
+      p->frame = NULL;
+      return true;
+    }
+  if (p->type == PAGE_MMAP)
+    {
+      write_back (p);
+      p->frame = NULL;
+      return true;
+    }
+
+  /* Gather the following pages that are dirty anyway and would
+     be evicted soon, pinning their frames.  A page that is dirty
+     before it is unmapped stays dirty. */
+  cluster[0] = p;
+  pagedir_batch_init (&batch, pd);
+  for (cnt = 1; cnt < SWAP_CLUSTER; cnt++)
+    {
+      struct page *q = find_page (owner, (uint8_t *) p->upage
+                                         + cnt * PGSIZE);
+      if (q == NULL || q->frame == NULL || q->type == PAGE_MMAP
+          || pagedir_is_accessed (pd, q->upage)
+          || !pagedir_is_dirty (pd, q->upage)
+          || !frame_try_pin (q->frame))
+        break;
+      settle_around (q, pd);
+      pagedir_batch_clear_page (&batch, q->upage);
+      cluster[cnt] = q;
+    }
+  pagedir_batch_flush (&batch);
+
+  for (i = 0; i < cnt; i++)
+    kpages[i] = cluster[i]->frame->kpage;
+  written = cnt;
+  slot = swap_out (kpages, &written);
+  if (slot == SWAP_ERROR)
+    written = 0;
+
+  /* P keeps its frame, which the caller reuses.  The others'
+     frames are freed. */
+  for (i = 0; i < cnt; i++)
+    {
+      struct page *q = cluster[i];
+
+      if (i < written)
+        {
+          q->swap_slot = slot + i;
+          if (q != p)
+            frame_free (q->frame, true);
+          q->frame = NULL;
+          swapped_cnt++;
+        }
+      else
+        {
+          /* No room in swap.  Map it again. */
+          pagedir_set_page (pd, q->upage, q->frame->kpage, q->writable);
+          pagedir_set_dirty (pd, q->upage, true);
+          if (q != p)
+            frame_unpin (q->frame);
+        }
+    }
+  return written > 0;
+}
+
+/* Prints statistics about demand paging. */
+void
+page_print_stats (void)
+{
+  printf ("Paging: %lld file pages read in %lld times, "
+          "%lld zero pages zeroed %lld times\n",
+          added_cnt[PAGE_FILE], loaded_cnt[PAGE_FILE],
+          added_cnt[PAGE_ZERO], loaded_cnt[PAGE_ZERO]);
+  printf ("Paging: %lld stack pages added on faults, limit %zu\n",
+          grown_cnt, stack_limit);
+  printf ("Paging: %lld zero pages and %lld merged pages copied on write\n",
+          zero_copied_cnt, merge_copied_cnt);
+  printf ("Paging: %lld pages mapped by fault-around, "
+          "%lld faults avoided, %lld never used\n",
+          around_cnt, avoided_cnt, unused_cnt);
+  printf ("Paging: %lld mapped file pages read in %lld times, "
+          "%lld written back\n",
+          added_cnt[PAGE_MMAP], loaded_cnt[PAGE_MMAP], write_back_cnt);
+  printf ("Paging: %lld dirty pages evicted to swap, %lld clean dropped, "
+          "%lld read ahead from swap\n",
+          swapped_cnt, dropped_cnt, read_ahead_cnt);
+}
+
+/* Brings page P of the current process into a frame and maps it,
+   and maps the pages after it too if it comes from a file.  A
+   zero page that is only being read, as WRITE says, maps the
+   zero page instead.  The caller must hold the current thread's
+   pages_lock.  Returns true if successful, false if no frame
+   could be obtained or P could not be read. */
+static bool
+page_in (struct page *p, bool write)
+{
+  if (p->swap_slot != SWAP_ERROR)
+    return page_in_swap (p);
+  if (p->type == PAGE_ZERO && !write)
+    return map_zero (p);
+  if (!map_page (p, true))
+    return false;
+  if (p->type == PAGE_FILE || p->type == PAGE_MMAP)
+    fault_around (p);
+  return true;
+}
+
+/* Brings page P of the current process, which is not in swap,
+   into a frame from its source and maps it.  If MAY_EVICT is
+   true, evicts another page if necessary to obtain the frame,
+   otherwise uses only free memory.  The caller must hold the
+   current thread's pages_lock.  Returns true if successful,
+   false if no frame could be obtained or P could not be read. */
+static bool
+map_page (struct page *p, bool may_evict)
+{
+  struct thread *t = thread_current ();
+  enum palloc_flags flags = p->type == PAGE_ZERO ? PAL_ZERO : 0;
+  struct frame *f;
+  uint8_t *kpage;
+
+  if (p->type == PAGE_FILE && !p->writable)
+    return map_shared (p, may_evict);
+
+  f = may_evict ? frame_alloc (p, flags) : frame_try_alloc (p, flags);
+  if (f == NULL)
+    return false;
+  kpage = f->kpage;
+
+  if (p->type == PAGE_FILE || p->type == PAGE_MMAP)
+    {
+      if (file_read_at (p->file, kpage, p->read_bytes, p->ofs)
+          != (int) p->read_bytes)
+        {
+          frame_free (f, true);
+          return false;
+        }
+      memset (kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+    }
+
+  if (!pagedir_set_page (t->pagedir, p->upage, kpage, p->writable))
+    {
+      frame_free (f, true);
+      return false;
+    }
+  loaded_cnt[p->type]++;
+  p->frame = f;
+  frame_unpin (f);
+  return true;
+}
+
+/* Maps read-only file page P of the current process to the frame
+   that all the processes running the same executable share,
+   evicting a page to bring it in only if MAY_EVICT is true.  The
+   caller must hold the current thread's pages_lock.  Returns
+   true if successful, false if no frame could be obtained or P
+   could not be read. */
+static bool
+map_shared (struct page *p, bool may_evict)
+{
+  struct thread *t = thread_current ();
+  struct share *s = share_get (p, may_evict);
+
+  if (s == NULL)
+    return false;
+  if (!pagedir_set_page (t->pagedir, p->upage, s->kpage, false))
+    {
+      share_put (s, p);
+      return false;
+    }
+  loaded_cnt[p->type]++;
+  p->share = s;
+  return true;
+}
+
+/* Maps zero page P of the current process, read-only, to the
+   zero page.  The caller must hold the current thread's
+   pages_lock.  Returns true if successful, false if memory
+   allocation failed. */
+static bool
+map_zero (struct page *p)
+{
+  struct thread *t = thread_current ();
+  struct share *s = share_zero ();
+
+  if (!pagedir_set_page (t->pagedir, p->upage, s->kpage, false))
+    {
+      share_put (s, p);
+      return false;
+    }
+  p->share = s;
+  return true;
+}
+
+/* Gives writable page P of the current process, which maps a
+   shared frame, a frame of its own with the same contents, and
+   maps that one instead, writable.  The caller must hold the
+   current thread's pages_lock.  Returns true if successful,
+   false if no frame could be obtained. */
+static bool
+unshare (struct page *p)
+{
+  struct thread *t = thread_current ();
+  struct share *s = p->share;
+  bool zero = share_is_zero (s);
+  struct frame *f;
+
+  ASSERT (p->writable);
+
+  f = frame_alloc (p, zero ? PAL_ZERO : 0);
+  if (f == NULL)
+    return false;
+  if (zero)
+    {
+      loaded_cnt[p->type]++;
+      zero_copied_cnt++;
+    }
+  else
+    {
+      memcpy (f->kpage, s->kpage, PGSIZE);
+      merge_copied_cnt++;
+    }
+
+  pagedir_clear_page (t->pagedir, p->upage);
+  if (!pagedir_set_page (t->pagedir, p->upage, f->kpage, true))
+    {
+      pagedir_set_page (t->pagedir, p->upage, s->kpage, false);
+      frame_free (f, true);
+      return false;
+    }
+  share_put (s, p);
+  p->share = NULL;
+  p->frame = f;
+  frame_unpin (f);
+  return true;
+}
+
+/* Maps, after file page P of the current process has been
+   brought in on a fault, the pages that follow P in the same
+   file that can be brought in without evicting anything, so that
+   a process going through a file sequentially does not fault on
+   every page.  The number of pages starts at one after a fault
+   out of sequence and doubles, up to FAULT_AROUND_MAX, on each
+   fault just past the pages mapped on the previous fault.  The
+   caller must hold the current thread's pages_lock. */
+static void
+fault_around (struct page *p)
+{
+  struct thread *t = thread_current ();
+  uint8_t *next = (uint8_t *) p->upage + PGSIZE;
+  size_t window, i;
+
+  if (p->upage == t->fault_next && t->fault_window > 0)
+    window = (t->fault_window * 2 < FAULT_AROUND_MAX
+              ? t->fault_window * 2 : FAULT_AROUND_MAX);
+  else
+    window = 1;
+  t->fault_window = window;
+
+  for (i = 1; i <= window; i++, next += PGSIZE)
+    {
+      struct page *q;
+
+      if (!is_user_vaddr (next))
+        break;
+      q = page_lookup (next);
+      if (q == NULL || q->type != p->type || q->file != p->file
+          || q->writable != p->writable
+          || q->ofs != p->ofs + (off_t) (i * PGSIZE)
+          || q->swap_slot != SWAP_ERROR)
+        break;
+      if (q->frame == NULL && q->share == NULL)
+        {
+          if (!map_page (q, false))
+            break;
+          q->around = true;
+          around_cnt++;
+        }
+    }
+  t->fault_next = next;
+}
+
+/* Brings page P of the current process in from swap, like
+   page_in(), reading ahead the pages around it in adjacent swap
+   slots that can have a free frame.  Pages after P are preferred
+   to pages before it, since programs mostly go up through
+   memory. */
+static bool
+page_in_swap (struct page *p)
+{
+  struct thread *t = thread_current ();
+  struct page *window[2 * SWAP_CLUSTER - 1];
+  void *kpages[SWAP_CLUSTER];
+  size_t center = SWAP_CLUSTER - 1;
+  size_t lo = center, hi = center;
+  size_t i;
+  struct page *q;
+  bool success = false;
+
+  p->frame = frame_alloc (p, 0);
+  if (p->frame == NULL)
+    return false;
+
+  window[center] = p;
+  while (hi - lo + 1 < SWAP_CLUSTER
+         && (q = read_ahead_page (p, hi - center + 1)) != NULL)
+    window[++hi] = q;
+  while (hi - lo + 1 < SWAP_CLUSTER
+         && (q = read_ahead_page (p, -(int) (center - lo + 1))) != NULL)
+    window[--lo] = q;
+
+  for (i = lo; i <= hi; i++)
+    kpages[i - lo] = window[i]->frame->kpage;
+  swap_in (window[lo]->swap_slot, kpages, hi - lo + 1);
+
+  for (i = lo; i <= hi; i++)
+    {
+      q = window[i];
+      if (pagedir_set_page (t->pagedir, q->upage, q->frame->kpage,
+                            q->writable))
+        {
+          swap_free (q->swap_slot);
+          q->swap_slot = SWAP_ERROR;
+          pagedir_set_dirty (t->pagedir, q->upage, true);
+          frame_unpin (q->frame);
+          if (q == p)
+            success = true;
+          else
+            read_ahead_cnt++;
+        }
+      else
+        {
+          /* Leave it in swap. */
+          frame_free (q->frame, true);
+          q->frame = NULL;
+        }
+    }
+  return success;
+}
+
+/* Writes page P of a mapped file, which must be in a frame, back
+   to its file.  The caller must hold the pages_lock of P's
+   owner. */
+static void
+write_back (struct page *p)
+{
+  ASSERT (p->type == PAGE_MMAP);
+  ASSERT (p->frame != NULL);
+
+  file_write_at (p->file, p->frame->kpage, p->read_bytes, p->ofs);
+  write_back_cnt++;
+}
+
+/* Returns the current process's page DELTA pages away from P, if
+   it is in swap DELTA slots away from P and a free frame can be
+   had for it, which is assigned to it.  Otherwise, returns a
+   null pointer. */
+static struct page *
+read_ahead_page (struct page *p, int delta)
+{
+  const uint8_t *upage = (const uint8_t *) p->upage + delta * PGSIZE;
+  struct page *q;
+
+  if (!is_user_vaddr (upage))
+    return NULL;
+  q = page_lookup (upage);
+  if (q == NULL || q->frame != NULL || q->swap_slot == SWAP_ERROR
+      || q->swap_slot != p->swap_slot + delta)
+    return NULL;
+  q->frame = frame_try_alloc (q, 0);
+  return q->frame != NULL ? q : NULL;
+}
+
+/* Returns a new PAGE_ZERO page for UPAGE, not yet in any table,
+   that is writable by the process if WRITABLE is true.  Returns
+   a null pointer if memory allocation fails. */
+static struct page *
+new_zero_page (void *upage, bool writable)
+{
+  struct page *p = slab_alloc (&page_cache);
+
+  if (p == NULL)
+    return NULL;
+  p->upage = upage;
+  p->type = PAGE_ZERO;
+  p->writable = writable;
+  p->file = NULL;
+  p->ofs = 0;
+  p->read_bytes = 0;
+  return p;
+}
+
+/* Adds P, whose type-specific members are already set, to the
+   current process's supplemental page table, taking the
+   current thread's pages_lock, since the evictor and the working
+   set sampler may be walking the table.  Frees P and returns
+   false if its page is already there. */
+static bool
+add_page (struct page *p)
+{
+  struct lock *pages_lock = &thread_current ()->pages_lock;
+  bool success;
+
+  lock_acquire (pages_lock);
+  success = insert_page (p);
+  lock_release (pages_lock);
+  return success;
+}
+
+/* Like add_page(), but the caller must hold the current thread's
+   pages_lock. */
+static bool
+insert_page (struct page *p)
+{
+  ASSERT (lock_held_by_current_thread (&thread_current ()->pages_lock));
+  ASSERT (pg_ofs (p->upage) == 0);
+  ASSERT (is_user_vaddr (p->upage));
+
+  p->owner = thread_current ();
+  p->frame = NULL;
+  p->share = NULL;
+  p->swap_slot = SWAP_ERROR;
+  p->around = false;
+  p->checksum = 0;
+  p->age = 0;
+  p->ref_clock = p->ref_sample = false;
+  if (hash_insert (&thread_current ()->pages, &p->elem) != NULL)
+    {
+      slab_free (&page_cache, p);
+      return false;
+    }
+  added_cnt[p->type]++;
+  return true;
+}
+
+/* If page P, mapped in PD, was mapped by fault_around() and has
+   not been accounted for since, counts it as a fault avoided if
+   it has been accessed, or as never used if not. */
+static void
+settle_around (struct page *p, uint32_t *pd)
+{
+  if (p->around)
+    {
+      if (pagedir_is_accessed (pd, p->upage))
+        avoided_cnt++;
+      else
+        unused_cnt++;
+      p->around = false;
+    }
+}
+
+/* If page P's accessed bit in PD is set, clears it and notes the
+   access for both page_was_accessed() and page_sample(). */
+static void
+collect_accessed (struct page *p, uint32_t *pd)
+{
+  if (pagedir_is_accessed (pd, p->upage))
+    {
+      settle_around (p, pd);
+      pagedir_set_accessed (pd, p->upage, false);
+      p->ref_clock = p->ref_sample = true;
+    }
+}
+
+/* Returns true if an access to FAULT_ADDR, by a process whose
+   stack pointer is ESP, should grow the process's stack: that
+   is, if FAULT_ADDR is within the stack limit below PHYS_BASE
+   and at most 32 bytes below ESP, which is as far as PUSHA
+   writes before it moves the stack pointer. */
+static bool
+is_stack_access (const void *fault_addr, const void *esp)
+{
+  const uint8_t *addr = fault_addr;
+
+  return (esp != NULL
+          && addr + 32 >= (const uint8_t *) esp
+          && addr >= (const uint8_t *) PHYS_BASE - stack_limit * PGSIZE);
+}
+
+/* Returns the page of thread T that contains UPAGE, or a null
+   pointer if there is none. */
+static struct page *
+find_page (struct thread *t, const void *upage)
+{
+  struct page p;
+  struct hash_elem *e;
+
+  p.upage = pg_round_down (upage);
+  e = hash_find (&t->pages, &p.elem);
+  return e != NULL ? hash_entry (e, struct page, elem) : NULL;
+}
+
+/* Returns a hash value for page P. */
+static unsigned
+page_hash (const struct hash_elem *p_, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (p_, struct page, elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, elem);
+  const struct page *b = hash_entry (b_, struct page, elem);
+
+  return a->upage < b->upage;
+}
+
+/* Frees page P of a supplemental page table being destroyed,
+   and its swap slot, and takes its frame out of the frame
+   table.  A shared frame, already unmapped by
+   page_table_destroy(), is let go instead. */
+static void
+page_destroy (struct hash_elem *p_, void *aux UNUSED)
+{
+  struct page *p = hash_entry (p_, struct page, elem);
+
+  settle_around (p, thread_current ()->pagedir);
+  if (p->share != NULL)
+    share_put (p->share, p);
+  if (p->frame != NULL)
+    frame_free (p->frame, false);
+  if (p->swap_slot != SWAP_ERROR)
+    swap_free (p->swap_slot);
+  slab_free (&page_cache, p);
+}
@@ -0,0 +1,73 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct frame;
+struct share;
+struct thread;
+
+/* Where a page's contents come from the first time it is
+   touched, and when it is brought back in after being evicted
+   clean. */
+enum page_type
+  {
+    PAGE_FILE,                  /* Read from a file, rest zeroed. */
+    PAGE_ZERO,                  /* All zeros. */
+    PAGE_MMAP,                  /* Mapped file, written back to it. */
+    PAGE_TYPE_CNT               /* Number of page types. */
+  };
+
+/* A page of a process's virtual address space, as recorded in
+   its supplemental page table. */
+struct page
+  {
+    void *upage;                /* User virtual address. */
+    struct thread *owner;       /* Process it belongs to. */
+    struct frame *frame;        /* Frame holding it, or null. */
+    struct share *share;        /* Shared frame mapped, or null. */
+    size_t swap_slot;           /* Swap slot holding it, or SWAP_ERROR. */
+    enum page_type type;        /* Source of contents. */
+    bool writable;              /* May the process write it? */
+    bool around;                /* Mapped by fault-around, not used yet? */
+    unsigned checksum;          /* Hash of contents when last scanned. */
+    uint8_t age;                /* Accessed in recent samples? Newest in
+                                   bit 7. */
+    bool ref_clock;             /* Accessed since clock hand passed? */
+    bool ref_sample;            /* Accessed since last sampled? */
+
+    /* PAGE_FILE and PAGE_MMAP only. */
+    struct file *file;          /* File to read. */
+    off_t ofs;                  /* Offset in FILE. */
+    size_t read_bytes;          /* Bytes to read, the rest zeroed. */
+
+    struct hash_elem elem;      /* Element in supplemental page table. */
+    struct list_elem share_elem; /* Element in merged share's pages. */
+  };
+
+void page_init (void);
+bool page_table_init (struct hash *);
+void page_table_destroy (struct hash *);
+struct page *page_lookup (const void *upage);
+bool page_add_file (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes, bool writable);
+bool page_add_zero (void *upage, bool writable);
+bool page_add_mmap (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes);
+void page_remove (void *upage);
+bool page_fault_in (const void *fault_addr, const void *esp, bool write);
+size_t page_set_stack_limit (size_t page_cnt);
+bool page_evict (struct page *);
+bool page_was_accessed (struct page *);
+bool page_merge (struct page *, bool create);
+bool page_unmerge (struct page *);
+unsigned page_sample (struct page *, uint32_t *pd);
+void page_print_stats (void);
+
+#endif /* vm/page.h */
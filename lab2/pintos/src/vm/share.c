@@ -0,0 +1,386 @@
+#include "vm/share.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+
+/* Shared executable pages.
+
+   Every process running the same executable would otherwise read
+   its own copy of each page of code and read-only data.  Instead,
+   read-only file pages are looked up here by the executable's
+   inode and the page's offset and length, and a process maps the
+   frame that is already there, if any, taking a reference to it.
+   The frame is freed when the last process that maps it unmaps
+   it, so once one process is running, each additional process
+   costs only its own data and stack pages.
+
+   A process's executable cannot be written while it runs (see
+   load()), so a shared page cannot go stale.
+
+   Shared frames are not in the frame table, so they are not
+   evicted while any process maps them.  Evicting one would mean
+   locking and unmapping it in every process that maps it, and
+   read-only pages of running executables are few and in use, so
+   they are not worth it.
+
+   Writable pages whose contents happen to be identical are shared
+   too, once the same-page merging scanner finds them (see
+   merge.c).  Such a merged page has no inode and is looked up by
+   its contents instead, and a process that writes it gets a copy
+   of its own (see page.c).  A merged page also keeps a list of
+   the pages that map it.  Once it has been mapped by only one
+   page for a whole lap of the scanner, which is long enough for
+   any partner page to have been merged with it, it is "lonely":
+   share_split_lonely() gives its frame back to that page as an
+   ordinary frame, which can be evicted again.
+
+   The zero page is shared the same way.  It is a frame of zeros
+   that a writable zero page maps, read-only, until the process
+   first writes it, so that a page that is only ever read costs no
+   memory of its own (see page.c).  It is not in the table of
+   shares, and it holds a reference to itself, so it is never
+   freed. */
+
+/* Shared pages, keyed by inode, offset, and length, or by
+   contents if merged. */
+static struct hash shares;
+static struct lock share_lock;
+
+/* Merged pages mapped by only one page, oldest first.
+   Protected by share_lock. */
+static struct list lonely;
+
+/* The zero page. */
+static struct share zero_share;
+
+/* Statistics. */
+static long long get_cnt;       /* Calls to share_get(). */
+static long long hit_cnt;       /* Calls that found the page. */
+static size_t peak_cnt;         /* Most pages shared at once. */
+static long long split_cnt;     /* Lonely merged pages split. */
+static long long zero_cnt;      /* Calls to share_zero(). */
+static unsigned zero_peak;      /* Most pages mapping the zero page. */
+
+/* Checksum of the zero page's contents. */
+static unsigned zero_checksum;
+
+static struct share *find_share (struct share *key);
+static bool is_merged (const struct share *);
+static void make_lonely (struct share *);
+static hash_hash_func share_hash;
+static hash_less_func share_less;
+
+/* Initializes the table of shared pages. */
+void
+share_init (void)
+{
+  hash_init (&shares, share_hash, share_less, NULL);
+  lock_init (&share_lock);
+  list_init (&lonely);
+
+  zero_share.inode = NULL;
+  zero_share.ofs = 0;
+  zero_share.read_bytes = 0;
+  zero_share.kpage = palloc_get_page (PAL_USER | PAL_ZERO | PAL_ASSERT);
+  zero_share.ref_cnt = 1;
+  zero_share.checksum = zero_checksum = hash_bytes (zero_share.kpage, PGSIZE);
+}
+
+/* Returns the shared frame for page P of the current process,
+   which must be a read-only PAGE_FILE page, with a reference
+   taken for P.  If no process has the page in memory yet, it is
+   read into a new frame, for which a page may be evicted only if
+   MAY_EVICT is true.  Returns a null pointer if no frame can be
+   obtained or the page cannot be read. */
+struct share *
+share_get (struct page *p, bool may_evict)
+{
+  struct share key;
+  struct share *s, *s2;
+  struct frame *f;
+
+  ASSERT (p->type == PAGE_FILE && !p->writable);
+
+  key.inode = file_get_inode (p->file);
+  key.ofs = p->ofs;
+  key.read_bytes = p->read_bytes;
+  key.checksum = 0;
+
+  lock_acquire (&share_lock);
+  get_cnt++;
+  s = find_share (&key);
+  if (s != NULL)
+    hit_cnt++;
+  lock_release (&share_lock);
+  if (s != NULL)
+    return s;
+
+  /* Obtain a frame through the frame table, which may evict a
+     page to get one, and read the page into it.  Both may take a
+     while, so they are done without holding SHARE_LOCK, and
+     another process may read the same page meanwhile. */
+  s = malloc (sizeof *s);
+  if (s == NULL)
+    f = NULL;
+  else if (may_evict)
+    f = frame_alloc (p, 0);
+  else
+    f = frame_try_alloc (p, 0);
+  if (f == NULL
+      || file_read_at (p->file, f->kpage, p->read_bytes, p->ofs)
+         != (int) p->read_bytes)
+    {
+      if (f != NULL)
+        frame_free (f, true);
+      free (s);
+      return NULL;
+    }
+  memset ((uint8_t *) f->kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+
+  /* Use the page another process read in the meantime, if any,
+     otherwise take ours out of the frame table and share it. */
+  lock_acquire (&share_lock);
+  s2 = find_share (&key);
+  if (s2 != NULL)
+    {
+      frame_free (f, true);
+      free (s);
+      s = s2;
+    }
+  else
+    {
+      *s = key;
+      s->kpage = f->kpage;
+      s->ref_cnt = 1;
+      frame_free (f, false);
+      hash_insert (&shares, &s->elem);
+      if (hash_size (&shares) > peak_cnt)
+        peak_cnt = hash_size (&shares);
+    }
+  lock_release (&share_lock);
+  return s;
+}
+
+/* Returns the zero page, with a reference taken for the page
+   that is to map it. */
+struct share *
+share_zero (void)
+{
+  lock_acquire (&share_lock);
+  zero_cnt++;
+  zero_share.ref_cnt++;
+  if (zero_share.ref_cnt - 1 > zero_peak)
+    zero_peak = zero_share.ref_cnt - 1;
+  lock_release (&share_lock);
+  return &zero_share;
+}
+
+/* Returns true if S is the zero page. */
+bool
+share_is_zero (const struct share *s)
+{
+  return s == &zero_share;
+}
+
+/* Returns a shared page with the same contents as KPAGE, a frame
+   whose contents hash to CHECKSUM and do not change during the
+   call, with a reference taken for page P, which is to map it:
+   the zero page, if KPAGE is all zeros, or a page merged before.
+   If there is none and CREATE is true, KPAGE becomes the frame of
+   a new merged page, owned by the table of shares from then on.
+   Returns a null pointer if there is none and CREATE is false,
+   or if memory allocation fails. */
+struct share *
+share_merge (struct page *p, void *kpage, unsigned checksum, bool create)
+{
+  struct share key;
+  struct share *s;
+
+  key.inode = NULL;
+  key.ofs = 0;
+  key.read_bytes = PGSIZE;
+  key.checksum = checksum;
+  key.kpage = kpage;
+
+  if (checksum == zero_checksum
+      && !memcmp (kpage, zero_share.kpage, PGSIZE))
+    return share_zero ();
+
+  lock_acquire (&share_lock);
+  s = find_share (&key);
+  if (s != NULL)
+    {
+      if (s->ref_cnt == 2)
+        list_remove (&s->lonely_elem);
+      list_push_back (&s->pages, &p->share_elem);
+    }
+  else if (create && (s = malloc (sizeof *s)) != NULL)
+    {
+      *s = key;
+      s->ref_cnt = 1;
+      list_init (&s->pages);
+      list_push_back (&s->pages, &p->share_elem);
+      make_lonely (s);
+      hash_insert (&shares, &s->elem);
+      if (hash_size (&shares) > peak_cnt)
+        peak_cnt = hash_size (&shares);
+    }
+  lock_release (&share_lock);
+  return s;
+}
+
+/* Drops page P's reference to shared page S, which must already
+   be unmapped from P, freeing S if it was the last. */
+void
+share_put (struct share *s, struct page *p)
+{
+  lock_acquire (&share_lock);
+  ASSERT (s->ref_cnt > 0);
+  if (is_merged (s))
+    {
+      list_remove (&p->share_elem);
+      if (s->ref_cnt == 1)
+        list_remove (&s->lonely_elem);
+      else if (s->ref_cnt == 2)
+        make_lonely (s);
+    }
+  if (--s->ref_cnt == 0)
+    {
+      hash_delete (&shares, &s->elem);
+      palloc_free_page (s->kpage);
+      free (s);
+    }
+  lock_release (&share_lock);
+}
+
+/* Gives the frame of each merged page that has been lonely for a
+   whole lap of the frame scanner back to the one page that maps
+   it, as an ordinary frame, and frees the shared page.  Skips the
+   pages whose owners are busy.  Called by the merging scanner. */
+void
+share_split_lonely (void)
+{
+  unsigned lap = frame_scan_lap ();
+  struct list_elem *e, *next;
+
+  lock_acquire (&share_lock);
+  for (e = list_begin (&lonely); e != list_end (&lonely); e = next)
+    {
+      struct share *s = list_entry (e, struct share, lonely_elem);
+      struct page *p = list_entry (list_front (&s->pages),
+                                   struct page, share_elem);
+      struct lock *owner_lock = &p->owner->pages_lock;
+
+      /* The list is oldest first. */
+      if (lap - s->lonely_lap < 2)
+        break;
+
+      /* P's owner cannot drop its reference while we hold
+         share_lock, so it is still around.  Only try its
+         pages_lock, which comes before share_lock in the locking
+         order. */
+      next = list_next (e);
+      if (!lock_try_acquire (owner_lock))
+        continue;
+      if (page_unmerge (p))
+        {
+          list_remove (&s->lonely_elem);
+          hash_delete (&shares, &s->elem);
+          free (s);
+          split_cnt++;
+        }
+      lock_release (owner_lock);
+    }
+  lock_release (&share_lock);
+}
+
+/* Prints statistics about shared pages. */
+void
+share_print_stats (void)
+{
+  printf ("Sharing: %lld of %lld read-only pages found in memory, "
+          "at most %zu shared at once\n", hit_cnt, get_cnt, peak_cnt);
+  printf ("Sharing: zero page mapped %lld times, "
+          "by at most %u pages at once\n", zero_cnt, zero_peak);
+  printf ("Sharing: %lld merged pages split again after their partners "
+          "left\n", split_cnt);
+}
+
+/* Returns the shared page equal to KEY, with a reference taken,
+   or a null pointer if there is none.  SHARE_LOCK must be
+   held. */
+static struct share *
+find_share (struct share *key)
+{
+  struct hash_elem *e;
+  struct share *s;
+
+  ASSERT (lock_held_by_current_thread (&share_lock));
+
+  e = hash_find (&shares, &key->elem);
+  if (e == NULL)
+    return NULL;
+  s = hash_entry (e, struct share, elem);
+  s->ref_cnt++;
+  return s;
+}
+
+/* Returns true if S is a merged page. */
+static bool
+is_merged (const struct share *s)
+{
+  return s->inode == NULL && s != &zero_share;
+}
+
+/* Adds merged page S, which has just come to be mapped by only
+   one page, to the end of the list of lonely shares.
+   SHARE_LOCK must be held. */
+static void
+make_lonely (struct share *s)
+{
+  s->lonely_lap = frame_scan_lap ();
+  list_push_back (&lonely, &s->lonely_elem);
+}
+
+/* Returns a hash value for shared page S. */
+static unsigned
+share_hash (const struct hash_elem *s_, void *aux UNUSED)
+{
+  const struct share *s = hash_entry (s_, struct share, elem);
+
+  if (s->inode == NULL)
+    return s->checksum;
+  return hash_bytes (&s->inode, sizeof s->inode) ^ hash_int (s->ofs);
+}
+
+/* Returns true if shared page A precedes shared page B.  Merged
+   pages are compared by contents. */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct share *a = hash_entry (a_, struct share, elem);
+  const struct share *b = hash_entry (b_, struct share, elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  else if (a->inode == NULL)
+    {
+      /* Merged pages are equal if their contents are. */
+      if (a->checksum != b->checksum)
+        return a->checksum < b->checksum;
+      return memcmp (a->kpage, b->kpage, PGSIZE) < 0;
+    }
+  else if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  else
+    return a->read_bytes < b->read_bytes;
+}
@@ -0,0 +1,42 @@
+#ifndef VM_SHARE_H
+#define VM_SHARE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct inode;
+struct page;
+
+/* A read-only page of an executable, shared by every process
+   that maps it, or a page of identical contents merged from
+   several processes' pages, or the zero page. */
+struct share
+  {
+    struct inode *inode;        /* Executable's inode, or null. */
+    off_t ofs;                  /* Offset of page in it. */
+    size_t read_bytes;          /* Bytes read, the rest zeroed. */
+    unsigned checksum;          /* Hash of contents, if merged. */
+    void *kpage;                /* Kernel address of frame. */
+    unsigned ref_cnt;           /* Number of pages mapping it. */
+    struct hash_elem elem;      /* Element in table of shares. */
+
+    /* Merged pages only. */
+    struct list pages;          /* Pages mapping it. */
+    unsigned lonely_lap;        /* Frame scan lap it became lonely in. */
+    struct list_elem lonely_elem; /* Element in list of lonely shares. */
+  };
+
+void share_init (void);
+struct share *share_get (struct page *, bool may_evict);
+struct share *share_zero (void);
+bool share_is_zero (const struct share *);
+struct share *share_merge (struct page *, void *kpage, unsigned checksum,
+                           bool create);
+void share_put (struct share *, struct page *);
+void share_split_lonely (void);
+void share_print_stats (void);
+
+#endif /* vm/share.h */
@@ -0,0 +1,166 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Swap.
+
+   Pages evicted from memory whose contents cannot be found
+   anywhere else are written to the block device in the
+   BLOCK_SWAP role.  The device is divided into slots of one page
+   each, whose use is tracked in a bitmap.  Pages are written to
+   free slots by swap_out(), which returns the first slot's
+   number, and read back by swap_in(), after which their owner
+   frees the slots with swap_free().
+
+   A page takes 8 sectors, so moving pages one sector per request
+   would spend most of the time issuing requests.  Instead,
+   swap_out() writes up to SWAP_CLUSTER pages to adjacent slots
+   in a single request, and swap_in() reads any run of adjacent
+   slots in one.  Callers pass pages that belong together, such
+   as neighbouring pages of one process, so that they can be
+   read back together too.  Slots are allocated next-fit from
+   where the last allocation ended, which keeps free runs long
+   and successive writes sequential on disk.
+
+   If there is no swap device, swap_out() always fails, so only
+   pages that can be read back from their files can be
+   evicted. */
+
+/* Sectors per page. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Swap device, or a null pointer if there is none. */
+static struct block *swap_device;
+
+/* Slots in use.  Protected by swap_lock. */
+static struct bitmap *used_map;
+static size_t used_cnt;
+static size_t next_slot;        /* Where to start looking. */
+static struct lock swap_lock;
+
+/* Statistics. */
+static long long out_cnt;       /* Pages written. */
+static long long out_req_cnt;   /* Write requests. */
+static long long in_cnt;        /* Pages read. */
+static long long in_req_cnt;    /* Read requests. */
+static size_t peak_cnt;         /* Most slots in use at once. */
+
+/* Initializes the swap module, using the block device in the
+   BLOCK_SWAP role, if there is one. */
+void
+swap_init (void)
+{
+  lock_init (&swap_lock);
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL)
+    return;
+
+  used_map = bitmap_create (block_size (swap_device) / PAGE_SECTORS);
+  if (used_map == NULL || !bitmap_add_summary (used_map))
+    PANIC ("swap bitmap creation failed--swap device is too large");
+}
+
+/* Writes as many as possible of the *CNT pages in KPAGES, up to
+   SWAP_CLUSTER, to adjacent free swap slots in one request,
+   sets *CNT to the number written, and returns the first slot's
+   number.  Returns SWAP_ERROR if swap is full or there is no
+   swap device. */
+size_t
+swap_out (void *const kpages[], size_t *cnt)
+{
+  const void *sectors[SWAP_CLUSTER * PAGE_SECTORS];
+  size_t slot = BITMAP_ERROR;
+  size_t n, i;
+
+  ASSERT (*cnt >= 1 && *cnt <= SWAP_CLUSTER);
+
+  if (used_map == NULL)
+    return SWAP_ERROR;
+
+  /* Find the longest run of free slots, up to *CNT, preferring
+     ones after the last allocation. */
+  lock_acquire (&swap_lock);
+  for (n = *cnt; n > 0 && slot == BITMAP_ERROR; n /= 2)
+    {
+      slot = bitmap_scan_and_flip (used_map, next_slot, n, false);
+      if (slot == BITMAP_ERROR && next_slot != 0)
+        slot = bitmap_scan_and_flip (used_map, 0, n, false);
+      if (slot != BITMAP_ERROR)
+        *cnt = n;
+    }
+  if (slot != BITMAP_ERROR)
+    {
+      next_slot = slot + *cnt;
+      used_cnt += *cnt;
+      if (used_cnt > peak_cnt)
+        peak_cnt = used_cnt;
+      out_cnt += *cnt;
+      out_req_cnt++;
+    }
+  lock_release (&swap_lock);
+  if (slot == BITMAP_ERROR)
+    return SWAP_ERROR;
+
+  for (i = 0; i < *cnt * PAGE_SECTORS; i++)
+    sectors[i] = (const uint8_t *) kpages[i / PAGE_SECTORS]
+                 + i % PAGE_SECTORS * BLOCK_SECTOR_SIZE;
+  block_write_multiple (swap_device, slot * PAGE_SECTORS,
+                        *cnt * PAGE_SECTORS, sectors);
+  return slot;
+}
+
+/* Reads the CNT pages in the adjacent swap slots starting at
+   SLOT into KPAGES, in one request.  The slots stay in use until
+   they are freed with swap_free(). */
+void
+swap_in (size_t slot, void *const kpages[], size_t cnt)
+{
+  void *sectors[SWAP_CLUSTER * PAGE_SECTORS];
+  size_t i;
+
+  ASSERT (used_map != NULL);
+  ASSERT (cnt >= 1 && cnt <= SWAP_CLUSTER);
+  ASSERT (bitmap_all (used_map, slot, cnt));
+
+  for (i = 0; i < cnt * PAGE_SECTORS; i++)
+    sectors[i] = (uint8_t *) kpages[i / PAGE_SECTORS]
+                 + i % PAGE_SECTORS * BLOCK_SECTOR_SIZE;
+  block_read_multiple (swap_device, slot * PAGE_SECTORS,
+                       cnt * PAGE_SECTORS, sectors);
+
+  lock_acquire (&swap_lock);
+  in_cnt += cnt;
+  in_req_cnt++;
+  lock_release (&swap_lock);
+}
+
+/* Frees swap slot SLOT. */
+void
+swap_free (size_t slot)
+{
+  ASSERT (used_map != NULL);
+
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (used_map, slot));
+  bitmap_reset (used_map, slot);
+  used_cnt--;
+  lock_release (&swap_lock);
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void)
+{
+  if (used_map == NULL)
+    printf ("Swap: no swap device\n");
+  else
+    printf ("Swap: %lld pages written in %lld requests, "
+            "%lld read in %lld, at most %zu of %zu slots in use\n",
+            out_cnt, out_req_cnt, in_cnt, in_req_cnt,
+            peak_cnt, bitmap_size (used_map));
+}
@@ -0,0 +1,19 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stddef.h>
+
+/* Returned by swap_out() when there is no room in swap, and
+   stored in a page that is not in swap. */
+#define SWAP_ERROR SIZE_MAX
+
+/* Most pages written or read in one request. */
+#define SWAP_CLUSTER 8
+
+void swap_init (void);
+size_t swap_out (void *const kpages[], size_t *cnt);
+void swap_in (size_t slot, void *const kpages[], size_t cnt);
+void swap_free (size_t slot);
+void swap_print_stats (void);
+
+#endif /* vm/swap.h */
@@ -0,0 +1,196 @@
+#include "vm/wset.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "vm/page.h"
+
+/* Working set estimation.
+
+   A process's working set is the set of pages it has used
+   recently.  If the -ws option turns sampling on, a sampler
+   thread wakes up every so many ticks and goes through the
+   supplemental page table of every process, shifting each page's
+   accessed bit into its age, a history of whether it was
+   accessed in each of the last 8 intervals between samples,
+   newest in the top bit (see page_sample()).  The number of
+   pages with any of the top 1, 2, 4, or 8 bits of their age set
+   is then the process's working set over a window of that many
+   intervals.  The clock in frame.c uses ages too: on its first
+   sweep, it passes over pages that are still in a working set.
+
+   Shared pages are counted in the working set of each process
+   that uses them, since each has its own accessed bit for them.
+
+   Each process's latest working sets, and the largest they have
+   been, are printed when it exits, and for every process by the
+   "stats" action. */
+
+/* Windows, in sample intervals. */
+static const unsigned windows[WSET_WINDOW_CNT] = {1, 2, 4, 8};
+
+/* Ticks between samples, or 0 if sampling is off. */
+static int64_t interval;
+
+/* Processes that have supplemental page tables.  Protected by
+   wset_lock, which is never acquired with a pages_lock held. */
+static struct list processes;
+static struct lock wset_lock;
+
+/* Statistics. */
+static long long sample_cnt;    /* Samples taken. */
+static long long page_cnt;      /* Pages sampled. */
+static long long sample_cycles; /* CPU cycles spent sampling. */
+
+static thread_func sampler;
+static void sample_process (struct thread *);
+static void print_wset (struct thread *);
+
+/* Initializes working set estimation and starts the sampler
+   thread, if sampling is on.  Must be called before any process
+   is created. */
+void
+wset_init (void)
+{
+  list_init (&processes);
+  lock_init (&wset_lock);
+  if (interval > 0)
+    thread_create ("wset", PRI_DEFAULT, sampler, NULL);
+}
+
+/* Sets the number of ticks between samples to TICKS and returns
+   the previous number.  Zero turns sampling off.  Takes effect
+   only before wset_init(). */
+int64_t
+wset_set_interval (int64_t ticks)
+{
+  int64_t old_interval = interval;
+
+  interval = ticks;
+  return old_interval;
+}
+
+/* Starts sampling the working set of process T, whose
+   supplemental page table has just been created. */
+void
+wset_add (struct thread *t)
+{
+  size_t i;
+
+  for (i = 0; i < WSET_WINDOW_CNT; i++)
+    t->wset[i] = t->wset_peak[i] = 0;
+  lock_acquire (&wset_lock);
+  list_push_back (&processes, &t->wset_elem);
+  lock_release (&wset_lock);
+}
+
+/* Stops sampling the working set of process T, whose
+   supplemental page table is about to be destroyed, and prints
+   it if sampling is on. */
+void
+wset_remove (struct thread *t)
+{
+  lock_acquire (&wset_lock);
+  list_remove (&t->wset_elem);
+  lock_release (&wset_lock);
+  if (interval > 0)
+    print_wset (t);
+}
+
+/* Prints the working set of every process. */
+void
+wset_print_all (void)
+{
+  struct list_elem *e;
+
+  lock_acquire (&wset_lock);
+  for (e = list_begin (&processes); e != list_end (&processes);
+       e = list_next (e))
+    print_wset (list_entry (e, struct thread, wset_elem));
+  lock_release (&wset_lock);
+}
+
+/* Prints statistics about working set sampling. */
+void
+wset_print_stats (void)
+{
+  printf ("Working sets: %lld samples every %lld ticks, "
+          "%lld pages sampled in %lld cycles\n",
+          sample_cnt, interval, page_cnt, sample_cycles);
+}
+
+/* The sampler thread.  Samples every process every interval
+   ticks. */
+static void
+sampler (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct list_elem *e;
+      uint64_t start;
+
+      timer_sleep (interval);
+      start = timer_cycles ();
+      lock_acquire (&wset_lock);
+      for (e = list_begin (&processes); e != list_end (&processes);
+           e = list_next (e))
+        sample_process (list_entry (e, struct thread, wset_elem));
+      lock_release (&wset_lock);
+      sample_cnt++;
+      sample_cycles += timer_cycles () - start;
+    }
+}
+
+/* Takes a sample of every page of process T and updates T's
+   working sets. */
+static void
+sample_process (struct thread *t)
+{
+  size_t wset[WSET_WINDOW_CNT] = {0};
+  struct hash_iterator it;
+  size_t i;
+
+  lock_acquire (&t->pages_lock);
+  hash_first (&it, &t->pages);
+  while (hash_next (&it))
+    {
+      struct page *p = hash_entry (hash_cur (&it), struct page, elem);
+      unsigned age = page_sample (p, t->pagedir);
+
+      for (i = 0; i < WSET_WINDOW_CNT; i++)
+        if (age >> (8 - windows[i]) != 0)
+          wset[i]++;
+      page_cnt++;
+    }
+  lock_release (&t->pages_lock);
+
+  for (i = 0; i < WSET_WINDOW_CNT; i++)
+    {
+      t->wset[i] = wset[i];
+      if (wset[i] > t->wset_peak[i])
+        t->wset_peak[i] = wset[i];
+    }
+}
+
+/* Prints the working sets of process T over each window, latest
+   and largest, as in "ws: working set 3/5/9/9 pages over
+   1/2/4/8 samples, at most 4/6/9/12". */
+static void
+print_wset (struct thread *t)
+{
+  size_t i;
+
+  printf ("%s: working set", t->name);
+  for (i = 0; i < WSET_WINDOW_CNT; i++)
+    printf ("%c%zu", i > 0 ? '/' : ' ', t->wset[i]);
+  printf (" pages over");
+  for (i = 0; i < WSET_WINDOW_CNT; i++)
+    printf ("%c%u", i > 0 ? '/' : ' ', windows[i]);
+  printf (" samples, at most");
+  for (i = 0; i < WSET_WINDOW_CNT; i++)
+    printf ("%c%zu", i > 0 ? '/' : ' ', t->wset_peak[i]);
+  printf ("\n");
+}
@@ -0,0 +1,18 @@
+#ifndef VM_WSET_H
+#define VM_WSET_H
+
+#include <stdint.h>
+
+struct thread;
+
+/* Number of windows over which working sets are measured. */
+#define WSET_WINDOW_CNT 4
+
+void wset_init (void);
+int64_t wset_set_interval (int64_t ticks);
+void wset_add (struct thread *);
+void wset_remove (struct thread *);
+void wset_print_all (void);
+void wset_print_stats (void);
+
+#endif /* vm/wset.h */